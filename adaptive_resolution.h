@@ -0,0 +1,279 @@
+//
+//  adaptive_resolution.h
+//  3D Object Drawing
+//
+
+#ifndef ADAPTIVE_RESOLUTION_H
+#define ADAPTIVE_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include "gpu_resources.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// Default resolution controller values
+const float RESOLUTION_TARGET_MS = 16.0f;       // GPU time per frame the controller aims for
+const float RESOLUTION_MIN_SCALE = 0.5f;        // lowest render scale, per axis
+const float RESOLUTION_STEP = 0.05f;            // the scale moves in these steps, so the target is not reallocated every frame
+const int RESOLUTION_SETTLE_FRAMES = 4;         // measurements dropped after a change; they may still be of the old scale
+const int GPU_TIMER_QUERIES = 4;                // frames in flight the timer can measure
+
+
+// GPU time of a frame from GL_TIME_ELAPSED queries. Results are read a few frames later, once
+// they are available, so measuring never waits for the GPU; when all queries are still in
+// flight the frame is simply not measured.
+class GpuFrameTimer
+{
+public:
+    GpuFrameTimer() : next(0), oldest(0), pending(0), running(false)
+    {
+        for (int i = 0; i < GPU_TIMER_QUERIES; i++)
+            queries[i] = 0;
+    }
+
+    void begin()
+    {
+        if (queries[0] == 0)
+            glGenQueries(GPU_TIMER_QUERIES, queries);
+        running = pending < GPU_TIMER_QUERIES;
+        if (running)
+            glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+    }
+
+    void end()
+    {
+        if (!running)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        next = (next + 1) % GPU_TIMER_QUERIES;
+        pending++;
+        running = false;
+    }
+
+    // the oldest finished measurement in milliseconds; false when none is ready yet
+    bool poll(float& milliseconds)
+    {
+        if (pending == 0)
+            return false;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &nanoseconds);
+        oldest = (oldest + 1) % GPU_TIMER_QUERIES;
+        pending--;
+        milliseconds = (float)(nanoseconds / 1.0e6);
+        return true;
+    }
+
+    void release()
+    {
+        if (queries[0] != 0)
+            glDeleteQueries(GPU_TIMER_QUERIES, queries);
+        for (int i = 0; i < GPU_TIMER_QUERIES; i++)
+            queries[i] = 0;
+        next = oldest = pending = 0;
+    }
+
+private:
+    GLuint queries[GPU_TIMER_QUERIES];
+    int next;
+    int oldest;
+    int pending;
+    bool running;
+};
+
+// Picks the render scale from measured GPU frame times. The pixel count goes with the square of
+// the scale, so when over budget the scale drops by the square root of the overshoot at once;
+// it only grows one step at a time, and only when the cost predicted for the larger size still
+// leaves some headroom, so it does not oscillate around the target.
+class ResolutionController
+{
+public:
+    float Scale;            // render size over window size, per axis
+    float TargetMs;
+    float AverageMs;        // smoothed GPU frame time
+    bool Enabled;           // false keeps the scale at 1
+
+    explicit ResolutionController(float targetMs = RESOLUTION_TARGET_MS)
+        : Scale(1.0f), TargetMs(targetMs), AverageMs(0.0f), Enabled(true), settle(0) {}
+
+    // feeds one measured frame; returns whether Scale changed
+    bool update(float gpuMs)
+    {
+        // frames still in flight at the old scale are left out of the average
+        if (settle > 0)
+        {
+            settle--;
+            return false;
+        }
+        AverageMs = AverageMs == 0.0f ? gpuMs : AverageMs + 0.2f * (gpuMs - AverageMs);
+        if (!Enabled)
+            return false;
+        float scale = Scale;
+        if (AverageMs > TargetMs)
+        {
+            float wanted = Scale * std::sqrt(TargetMs / AverageMs);
+            scale = std::min(std::floor(wanted / RESOLUTION_STEP) * RESOLUTION_STEP, Scale - RESOLUTION_STEP);
+        }
+        else
+        {
+            float larger = Scale + RESOLUTION_STEP;
+            if (AverageMs * (larger * larger) / (Scale * Scale) < 0.9f * TargetMs)
+                scale = larger;
+        }
+        scale = std::min(std::max(scale, RESOLUTION_MIN_SCALE), 1.0f);
+        if (std::fabs(scale - Scale) < 0.5f * RESOLUTION_STEP)
+            return false;
+        Scale = scale;
+        AverageMs = 0.0f;
+        settle = RESOLUTION_SETTLE_FRAMES;
+        return true;
+    }
+
+    // size of the render target for a window of the given size
+    int scaled(int size) const
+    {
+        return std::max((int)(size * (Enabled ? Scale : 1.0f) + 0.5f), 1);
+    }
+
+private:
+    int settle;
+};
+
+// Offscreen target the main pass is drawn into at the render resolution: color (RGBA8, or
+// GL_RGBA16F for post-processing in HDR) and a depth renderbuffer (GL_DEPTH_COMPONENT32F for
+// reverse-Z), multisampled when Samples is over 0. The single-sampled color is a texture,
+// ColorTexture, so a post-processing pass can sample it; with samples it is the resolve target.
+// end() scales the color up to the window with linear filtering; a multisampled target is first
+// resolved into a single-sampled one of the same size, since a blit cannot resolve and scale at once.
+class SceneTarget
+{
+public:
+    unsigned int FBO;
+    unsigned int Color;             // the color attachment: a renderbuffer with samples, else ColorTexture
+    unsigned int ColorTexture;
+    unsigned int Depth;
+    GLenum ColorFormat;
+    GLenum DepthFormat;
+    int Samples;
+    int Width;
+    int Height;
+
+    explicit SceneTarget(GLenum depthFormat = GL_DEPTH_COMPONENT24, int samples = 0, GLenum colorFormat = GL_RGBA8)
+        : FBO(0), Color(0), ColorTexture(0), Depth(0), ColorFormat(colorFormat), DepthFormat(depthFormat), Samples(samples), Width(0), Height(0) {}
+
+    // binds (and on a size change reallocates) the target and clears it
+    void begin(int width, int height)
+    {
+        if (width != Width || height != Height)
+            allocate(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        gpuResources().countStateChange();
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // binds the single-sampled color for reading, resolving the samples first when there are any
+    void resolve()
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        if (Samples == 0)
+            return;
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gpuResources().get(resolvedFramebuffer));
+        glBlitFramebuffer(0, 0, Width, Height, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, gpuResources().get(resolvedFramebuffer));
+    }
+
+    // copies the color to the window, stretched to its size, and leaves the window bound
+    void end(int windowWidth, int windowHeight)
+    {
+        resolve();
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, Width, Height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+            windowWidth == Width && windowHeight == Height ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+    }
+
+    void release()
+    {
+        gpuResources().destroy(framebuffer);
+        gpuResources().destroy(colorBuffer);
+        gpuResources().destroy(depthBuffer);
+        gpuResources().destroy(resolvedFramebuffer);
+        gpuResources().destroy(colorTexture);
+        FBO = Color = ColorTexture = Depth = 0;
+        Width = Height = 0;
+    }
+
+private:
+    GpuHandle framebuffer;
+    GpuHandle colorBuffer;
+    GpuHandle depthBuffer;
+    GpuHandle resolvedFramebuffer;
+    GpuHandle colorTexture;
+
+    // the old buffers are only deleted once the GPU is done with the frames drawn into them
+    void allocate(int width, int height)
+    {
+        release();
+        Width = width;
+        Height = height;
+        size_t pixels = (size_t)width * height;
+        size_t samples = std::max(Samples, 1);
+        size_t colorBytes = ColorFormat == GL_RGBA16F ? 8 : 4;
+
+        // the single-sampled color, sampled through its base level; mips are left to whoever generates them
+        colorTexture = gpuResources().create(GPU_TEXTURE, Samples > 0 ? "scene resolved color" : "scene color");
+        gpuResources().setBytes(colorTexture, pixels * colorBytes);
+        ColorTexture = gpuResources().get(colorTexture);
+        glBindTexture(GL_TEXTURE_2D, ColorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, ColorFormat, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (Samples > 0)
+        {
+            colorBuffer = gpuResources().create(GPU_RENDERBUFFER, "scene color");
+            gpuResources().setBytes(colorBuffer, pixels * samples * colorBytes);
+            Color = gpuResources().get(colorBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, Color);
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, Samples, ColorFormat, width, height);
+            resolvedFramebuffer = gpuResources().create(GPU_FRAMEBUFFER, "scene resolve target");
+            glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(resolvedFramebuffer));
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ColorTexture, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::SCENE_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        else
+            Color = ColorTexture;
+        depthBuffer = gpuResources().create(GPU_RENDERBUFFER, "scene depth");
+        gpuResources().setBytes(depthBuffer, pixels * samples * 4);
+        Depth = gpuResources().get(depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, Depth);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, Samples, DepthFormat, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        framebuffer = gpuResources().create(GPU_FRAMEBUFFER, "scene target");
+        FBO = gpuResources().get(framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        if (Samples > 0)
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Color);
+        else
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ColorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, Depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SCENE_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif
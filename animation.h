@@ -0,0 +1,497 @@
+//
+//  animation.h
+//  3D Object Drawing
+//
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANIMATION_SSE2
+#endif
+
+// Default animation values
+const std::string ANIMATION_PATH = "scenes/room.anim";
+const int ANIMATION_LANES = 4;          // tracks sampled together; the track arrays are padded to a multiple of it
+
+
+enum AnimationChannel
+{
+    ANIMATION_TRANSLATE,
+    ANIMATION_ROTATE,
+    ANIMATION_SCALE,
+    ANIMATION_CHANNEL_COUNT
+};
+
+// A joint of the hierarchy. The rest pose is relative to the parent; parents always come
+// before their children, so one pass in order resolves the world transforms.
+struct AnimationNode
+{
+    std::string name;
+    int parent;                 // -1 for a root
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+// Keyframes of one channel of one node, sampled linearly (rotations as normalized lerp of
+// quaternions, so a track should not turn more than about 90 degrees between two keys)
+struct AnimationTrack
+{
+    int node;
+    AnimationChannel channel;
+    std::vector<float> times;
+    std::vector<glm::vec4> values;      // xyz for translate and scale, quaternion xyzw for rotate
+    size_t cursor;                      // segment of the last sample; playback mostly moves forward
+};
+
+struct AnimationClip
+{
+    std::string name;
+    float length;
+    bool loop;
+    std::vector<int> tracks;
+    float Time;
+    float Speed;
+    float Weight;               // 0 stops the clip; the weights of the clips on a node blend
+};
+
+// Keyframe animation of a node hierarchy: fans, doors, drawers. advance() moves the clocks of
+// the clips in the fixed simulation step, evaluate() poses the hierarchy once per frame:
+//   1. every track of a clip with a weight finds its segment and copies its two keys and the
+//      fraction between them into structure-of-arrays buffers,
+//   2. the buffers are interpolated ANIMATION_LANES tracks at a time (SSE2 where available),
+//      rotations normalized in the same pass,
+//   3. the samples are blended per node and channel by clip weight, with the rest pose making
+//      up weights under 1,
+//   4. the local and world matrices are rebuilt for the nodes that moved and their children.
+// The cost follows the tracks of the playing clips; nodes nothing plays on keep their matrices.
+//
+// Animation file, '#' starts a comment:
+//     node <name> [parent <node>] [pos x y z] [rot x y z] [scale x y z]    (rest pose, degrees)
+//     clip <name> <length in seconds> [loop]
+//         translate|rotate|scale <node> <time> <x y z>                     (keys in time order)
+//     end
+//     play <clip> [weight w] [speed s]
+class Animator
+{
+public:
+    std::vector<AnimationNode> Nodes;
+    std::vector<AnimationTrack> Tracks;
+    std::vector<AnimationClip> Clips;
+    int ActiveTracks;           // tracks sampled by the last evaluate()
+    int UpdatedNodes;           // nodes whose matrices it rebuilt
+
+    Animator() : ActiveTracks(0), UpdatedNodes(0) {}
+
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::ANIMATION::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        int clip = -1;
+        for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+        {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword))
+                continue;
+
+            bool ok = true;
+            if (keyword == "node" && clip < 0)
+            {
+                std::string name, key, parent;
+                glm::vec3 position(0.0f), rotation(0.0f), scale(1.0f);
+                ok = (bool)(words >> name) && find(name) < 0;
+                while (ok && words >> key)
+                {
+                    if (key == "parent") ok = (bool)(words >> parent) && find(parent) >= 0;
+                    else if (key == "pos") ok = readVec3(words, position);
+                    else if (key == "rot") ok = readVec3(words, rotation);
+                    else if (key == "scale") ok = readVec3(words, scale);
+                    else ok = false;
+                }
+                if (ok)
+                    addNode(name, parent.empty() ? -1 : find(parent), position, eulerRotation(rotation), scale);
+            }
+            else if (keyword == "clip" && clip < 0)
+            {
+                std::string name, loop;
+                float length = 0.0f;
+                ok = (bool)(words >> name >> length) && length > 0.0f && findClip(name) < 0;
+                if (words >> loop)
+                    ok = ok && loop == "loop";
+                if (ok)
+                    clip = addClip(name, length, loop == "loop");
+            }
+            else if (keyword == "end" && clip >= 0)
+                clip = -1;
+            else if ((keyword == "translate" || keyword == "rotate" || keyword == "scale") && clip >= 0)
+            {
+                std::string node;
+                float time = 0.0f;
+                glm::vec3 value;
+                ok = (bool)(words >> node >> time) && readVec3(words, value) && find(node) >= 0;
+                AnimationChannel channel = keyword == "translate" ? ANIMATION_TRANSLATE : keyword == "rotate" ? ANIMATION_ROTATE : ANIMATION_SCALE;
+                if (ok)
+                {
+                    glm::quat rotation = eulerRotation(value);
+                    ok = addKey(clip, find(node), channel, time, channel == ANIMATION_ROTATE ? glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w) : glm::vec4(value, 0.0f));
+                }
+            }
+            else if (keyword == "play" && clip < 0)
+            {
+                std::string name, key;
+                float weight = 1.0f, speed = 1.0f;
+                ok = (bool)(words >> name) && findClip(name) >= 0;
+                while (ok && words >> key)
+                {
+                    if (key == "weight") ok = (bool)(words >> weight);
+                    else if (key == "speed") ok = (bool)(words >> speed);
+                    else ok = false;
+                }
+                if (ok)
+                    play(findClip(name), weight, speed);
+            }
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                std::cout << "ERROR::ANIMATION::SYNTAX: " << path << ":" << lineNumber << ": " << line << std::endl;
+                return false;
+            }
+        }
+        return clip < 0;
+    }
+
+    int addNode(const std::string& name, int parent, glm::vec3 translation, glm::quat rotation, glm::vec3 scale)
+    {
+        AnimationNode node;
+        node.name = name;
+        node.parent = parent;
+        node.translation = translation;
+        node.rotation = rotation;
+        node.scale = scale;
+        names[name] = (int)Nodes.size();
+        Nodes.push_back(node);
+        glm::mat4 local = compose(translation, rotation, scale);
+        worlds.push_back(parent >= 0 ? worlds[parent] * local : local);
+        NodeState state = { { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) }, { 0.0f, 0.0f, 0.0f }, false, false, false };
+        states.push_back(state);
+        return (int)Nodes.size() - 1;
+    }
+
+    int addClip(const std::string& name, float length, bool loop)
+    {
+        AnimationClip clip;
+        clip.name = name;
+        clip.length = length;
+        clip.loop = loop;
+        clip.Time = 0.0f;
+        clip.Speed = 1.0f;
+        clip.Weight = 0.0f;
+        Clips.push_back(clip);
+        return (int)Clips.size() - 1;
+    }
+
+    // appends a key to the clip's track for that node and channel; false when it is not after the last one
+    bool addKey(int clip, int node, AnimationChannel channel, float time, glm::vec4 value)
+    {
+        AnimationClip& target = Clips[clip];
+        int track = -1;
+        for (size_t i = 0; i < target.tracks.size(); i++)
+            if (Tracks[target.tracks[i]].node == node && Tracks[target.tracks[i]].channel == channel)
+                track = target.tracks[i];
+        if (track < 0)
+        {
+            AnimationTrack created;
+            created.node = node;
+            created.channel = channel;
+            created.cursor = 0;
+            track = (int)Tracks.size();
+            Tracks.push_back(created);
+            target.tracks.push_back(track);
+            reserveLanes();
+        }
+        AnimationTrack& keys = Tracks[track];
+        if (!keys.times.empty() && time <= keys.times.back())
+            return false;
+        // the shorter way round from the previous key, so the lerp never crosses the sphere
+        if (channel == ANIMATION_ROTATE && !keys.values.empty() && glm::dot(keys.values.back(), value) < 0.0f)
+            value = -value;
+        keys.times.push_back(time);
+        keys.values.push_back(value);
+        return true;
+    }
+
+    void play(int clip, float weight = 1.0f, float speed = 1.0f)
+    {
+        Clips[clip].Weight = weight;
+        Clips[clip].Speed = speed;
+    }
+
+    int find(const std::string& name) const
+    {
+        std::map<std::string, int>::const_iterator it = names.find(name);
+        return it == names.end() ? -1 : it->second;
+    }
+
+    int findClip(const std::string& name) const
+    {
+        for (size_t i = 0; i < Clips.size(); i++)
+            if (Clips[i].name == name)
+                return (int)i;
+        return -1;
+    }
+
+    const glm::mat4& World(int node) const
+    {
+        return worlds[node];
+    }
+
+    // simulation step: moves the clocks of the playing clips
+    void advance(float seconds)
+    {
+        for (size_t i = 0; i < Clips.size(); i++)
+        {
+            AnimationClip& clip = Clips[i];
+            if (clip.Weight <= 0.0f)
+                continue;
+            clip.Time += seconds * clip.Speed;
+            if (clip.loop)
+                clip.Time -= clip.length * std::floor(clip.Time / clip.length);
+            else
+                clip.Time = glm::clamp(clip.Time, 0.0f, clip.length);
+        }
+    }
+
+    // poses the hierarchy at the clips' current times
+    void evaluate()
+    {
+        // 1. gather the two keys around the clip time of every playing track
+        int count = 0;
+        for (size_t c = 0; c < Clips.size(); c++)
+        {
+            const AnimationClip& clip = Clips[c];
+            if (clip.Weight <= 0.0f)
+                continue;
+            for (size_t i = 0; i < clip.tracks.size(); i++)
+            {
+                AnimationTrack& track = Tracks[clip.tracks[i]];
+                if (track.times.empty())
+                    continue;
+                size_t last = track.times.size() - 1;
+                if (track.cursor > last || clip.Time < track.times[track.cursor])
+                    track.cursor = 0;
+                while (track.cursor < last && track.times[track.cursor + 1] <= clip.Time)
+                    track.cursor++;
+                size_t next = std::min(track.cursor + 1, last);
+                float span = track.times[next] - track.times[track.cursor];
+                float fraction = span > 0.0f ? glm::clamp((clip.Time - track.times[track.cursor]) / span, 0.0f, 1.0f) : 0.0f;
+                const glm::vec4& a = track.values[track.cursor];
+                const glm::vec4& b = track.values[next];
+                for (int k = 0; k < 4; k++)
+                {
+                    from[k][count] = a[k];
+                    to[k][count] = b[k];
+                }
+                t[count] = fraction;
+                normalized[count] = track.channel == ANIMATION_ROTATE ? 1.0f : 0.0f;
+                sampledTrack[count] = clip.tracks[i];
+                sampledWeight[count] = clip.Weight;
+                count++;
+            }
+        }
+        ActiveTracks = count;
+
+        // 2. interpolate all of them, a lane per track
+        interpolate(count);
+
+        // 3. blend per node and channel
+        for (int i = 0; i < count; i++)
+        {
+            const AnimationTrack& track = Tracks[sampledTrack[i]];
+            NodeState& state = states[track.node];
+            if (!state.posed)
+            {
+                for (int k = 0; k < ANIMATION_CHANNEL_COUNT; k++)
+                {
+                    state.sum[k] = glm::vec4(0.0f);
+                    state.weight[k] = 0.0f;
+                }
+                state.posed = true;
+            }
+            glm::vec4 value(sample[0][i], sample[1][i], sample[2][i], sample[3][i]);
+            if (track.channel == ANIMATION_ROTATE)
+            {
+                const glm::quat& rest = Nodes[track.node].rotation;
+                if (glm::dot(value, glm::vec4(rest.x, rest.y, rest.z, rest.w)) < 0.0f)
+                    value = -value;
+            }
+            state.sum[track.channel] += value * sampledWeight[i];
+            state.weight[track.channel] += sampledWeight[i];
+        }
+
+        // 4. matrices of the posed nodes, of the nodes that went back to rest and of their children
+        UpdatedNodes = 0;
+        for (size_t n = 0; n < Nodes.size(); n++)
+        {
+            NodeState& state = states[n];
+            const AnimationNode& node = Nodes[n];
+            state.moved = state.posed || state.wasPosed || (node.parent >= 0 && states[node.parent].moved);
+            if (!state.moved)
+                continue;
+            glm::mat4 local;
+            if (state.posed)
+            {
+                glm::vec4 rest[ANIMATION_CHANNEL_COUNT] = { glm::vec4(node.translation, 0.0f),
+                    glm::vec4(node.rotation.x, node.rotation.y, node.rotation.z, node.rotation.w), glm::vec4(node.scale, 0.0f) };
+                glm::vec4 pose[ANIMATION_CHANNEL_COUNT];
+                for (int k = 0; k < ANIMATION_CHANNEL_COUNT; k++)
+                {
+                    float weight = state.weight[k];
+                    glm::vec4 sum = state.sum[k];
+                    if (weight < 1.0f)
+                    {
+                        sum += rest[k] * (1.0f - weight);
+                        weight = 1.0f;
+                    }
+                    pose[k] = sum / weight;
+                }
+                glm::vec4 q = glm::normalize(pose[ANIMATION_ROTATE]);
+                local = compose(glm::vec3(pose[ANIMATION_TRANSLATE]), glm::quat(q.w, q.x, q.y, q.z), glm::vec3(pose[ANIMATION_SCALE]));
+            }
+            else
+                local = compose(node.translation, node.rotation, node.scale);
+            worlds[n] = node.parent >= 0 ? worlds[node.parent] * local : local;
+            state.wasPosed = state.posed;
+            state.posed = false;
+            UpdatedNodes++;
+        }
+    }
+
+    // rotate X, then Y, then Z in degrees, the order of sceneTransform()
+    static glm::quat eulerRotation(glm::vec3 degrees)
+    {
+        return glm::angleAxis(glm::radians(degrees.x), glm::vec3(1.0f, 0.0f, 0.0f))
+            * glm::angleAxis(glm::radians(degrees.y), glm::vec3(0.0f, 1.0f, 0.0f))
+            * glm::angleAxis(glm::radians(degrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+private:
+    struct NodeState
+    {
+        glm::vec4 sum[ANIMATION_CHANNEL_COUNT];     // weighted samples of this evaluate()
+        float weight[ANIMATION_CHANNEL_COUNT];
+        bool posed;             // a playing track reached the node this evaluate()
+        bool wasPosed;          // and the last one, so it returns to rest once when they stop
+        bool moved;             // its world matrix changed this evaluate()
+    };
+
+    std::map<std::string, int> names;
+    std::vector<glm::mat4> worlds;
+    std::vector<NodeState> states;
+
+    // per sampled track, padded to whole groups of ANIMATION_LANES
+    std::vector<float> from[4], to[4], sample[4];
+    std::vector<float> t, normalized, sampledWeight;
+    std::vector<int> sampledTrack;
+
+    // translate * rotate * scale
+    static glm::mat4 compose(glm::vec3 translation, glm::quat rotation, glm::vec3 scale)
+    {
+        glm::mat4 m = glm::mat4_cast(rotation);
+        m[0] *= scale.x;
+        m[1] *= scale.y;
+        m[2] *= scale.z;
+        m[3] = glm::vec4(translation, 1.0f);
+        return m;
+    }
+
+    // sized for every track playing at once, so evaluate() never allocates
+    void reserveLanes()
+    {
+        size_t lanes = (Tracks.size() + ANIMATION_LANES - 1) / ANIMATION_LANES * ANIMATION_LANES;
+        for (int k = 0; k < 4; k++)
+        {
+            from[k].resize(lanes, 0.0f);
+            to[k].resize(lanes, 0.0f);
+            sample[k].resize(lanes, 0.0f);
+        }
+        t.resize(lanes, 0.0f);
+        normalized.resize(lanes, 0.0f);
+        sampledWeight.resize(lanes, 0.0f);
+        sampledTrack.resize(lanes, 0);
+    }
+
+    // sample = from + (to - from) * t, scaled to unit length where normalized is set
+    void interpolate(int count)
+    {
+        int lanes = (count + ANIMATION_LANES - 1) / ANIMATION_LANES * ANIMATION_LANES;
+#ifdef ANIMATION_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (int i = 0; i < lanes; i += ANIMATION_LANES)
+        {
+            __m128 fraction = _mm_loadu_ps(&t[i]);
+            __m128 values[4];
+            __m128 lengthSquared = zero;
+            for (int k = 0; k < 4; k++)
+            {
+                __m128 a = _mm_loadu_ps(&from[k][i]);
+                __m128 b = _mm_loadu_ps(&to[k][i]);
+                values[k] = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fraction));
+                lengthSquared = _mm_add_ps(lengthSquared, _mm_mul_ps(values[k], values[k]));
+            }
+            // translate and scale lanes keep a factor of 1, whatever their length is
+            __m128 rotations = _mm_cmpgt_ps(_mm_loadu_ps(&normalized[i]), zero);
+            __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+            __m128 factor = _mm_or_ps(_mm_and_ps(rotations, inverse), _mm_andnot_ps(rotations, one));
+            for (int k = 0; k < 4; k++)
+                _mm_storeu_ps(&sample[k][i], _mm_mul_ps(values[k], factor));
+        }
+#else
+        for (int i = 0; i < lanes; i++)
+        {
+            float values[4];
+            float lengthSquared = 0.0f;
+            for (int k = 0; k < 4; k++)
+            {
+                values[k] = from[k][i] + (to[k][i] - from[k][i]) * t[i];
+                lengthSquared += values[k] * values[k];
+            }
+            float factor = normalized[i] > 0.0f ? 1.0f / std::sqrt(lengthSquared) : 1.0f;
+            for (int k = 0; k < 4; k++)
+                sample[k][i] = values[k] * factor;
+        }
+#endif
+    }
+
+    static bool readVec3(std::istream& in, glm::vec3& v)
+    {
+        return (bool)(in >> v.x >> v.y >> v.z);
+    }
+};
+
+#endif
@@ -12,12 +12,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-class BasicCamera {
-public:
+#include "camera_base.h"
 
-    glm::vec3 eye;
-    glm::vec3 lookAt;
-    glm::vec3 V;
+// Camera from an eye point, a look-at point and a view-up vector. They are private and only
+// change through the change* functions, so the cached matrices (see CameraBase) are always
+// rebuilt after a change.
+class BasicCamera : public CameraBase {
+public:
 
     BasicCamera(float eyeX = 0.0, float eyeY = 1.0, float eyeZ = 3.0, float lookAtX = 0.0, float lookAtY = 0.0, float lookAtZ = 0.0, glm::vec3 viewUpVector = glm::vec3(0.0f, 1.0f, 0.0f))
     {
@@ -28,57 +29,88 @@ public:
 
     glm::mat4 createViewMatrix()
     {
-        glm::mat4 viewMatrix;
-
-        glm::vec3 N = eye - lookAt;
-        glm::vec3 U = glm::cross(V, N);
-        u = glm::normalize(U);
-        v = glm::normalize(glm::cross(N, U));
-        n = glm::normalize(N);
+        return GetViewMatrix();
+    }
 
-        float dx = glm::dot(-eye, u);
-        float dy = glm::dot(-eye, v);
-        float dz = glm::dot(-eye, n);
+    glm::vec3 GetEyePosition() const
+    {
+        return eye;
+    }
 
-        viewMatrix[0].x = u.x;  viewMatrix[1].x = u.y;  viewMatrix[2].x = u.z;  viewMatrix[3].x = dx;
-        viewMatrix[0].y = v.x;  viewMatrix[1].y = v.y;  viewMatrix[2].y = v.z;  viewMatrix[3].y = dy;
-        viewMatrix[0].z = n.x;  viewMatrix[1].z = n.y;  viewMatrix[2].z = n.z;  viewMatrix[3].z = dz;
-        viewMatrix[0].w = 0.0f; viewMatrix[1].w = 0.0f; viewMatrix[2].w = 0.0f; viewMatrix[3].w = 1.0f;
+    glm::vec3 GetLookAt() const
+    {
+        return lookAt;
+    }
 
-        return viewMatrix;
+    glm::vec3 GetViewUpVector() const
+    {
+        return V;
     }
 
     void changeEye(float eyeX, float eyeY, float eyeZ)
     {
         eye = glm::vec3(eyeX, eyeY, eyeZ);
+        invalidateView();
     }
 
     void changeLookAt(float lookAtX, float lookAtY, float lookAtZ)
     {
         lookAt = glm::vec3(lookAtX, lookAtY, lookAtZ);
+        invalidateView();
     }
 
     void changeViewUpVector(glm::vec3 viewUpVector)
     {
         V = viewUpVector;
+        invalidateView();
     }
 
     glm::vec3 get_u()
     {
+        GetViewMatrix();
         return u;
     }
 
     glm::vec3 get_v()
     {
+        GetViewMatrix();
         return v;
     }
 
     glm::vec3 get_n()
     {
+        GetViewMatrix();
         return n;
     }
 
+protected:
+    // builds the u/v/n basis; only runs when eye, look-at point or view-up changed
+    glm::mat4 buildViewMatrix()
+    {
+        glm::mat4 viewMatrix;
+
+        glm::vec3 N = eye - lookAt;
+        glm::vec3 U = glm::cross(V, N);
+        u = glm::normalize(U);
+        v = glm::normalize(glm::cross(N, U));
+        n = glm::normalize(N);
+
+        float dx = glm::dot(-eye, u);
+        float dy = glm::dot(-eye, v);
+        float dz = glm::dot(-eye, n);
+
+        viewMatrix[0].x = u.x;  viewMatrix[1].x = u.y;  viewMatrix[2].x = u.z;  viewMatrix[3].x = dx;
+        viewMatrix[0].y = v.x;  viewMatrix[1].y = v.y;  viewMatrix[2].y = v.z;  viewMatrix[3].y = dy;
+        viewMatrix[0].z = n.x;  viewMatrix[1].z = n.y;  viewMatrix[2].z = n.z;  viewMatrix[3].z = dz;
+        viewMatrix[0].w = 0.0f; viewMatrix[1].w = 0.0f; viewMatrix[2].w = 0.0f; viewMatrix[3].w = 1.0f;
+
+        return viewMatrix;
+    }
+
 private:
+    glm::vec3 eye;
+    glm::vec3 lookAt;
+    glm::vec3 V;
     glm::vec3 u;
     glm::vec3 v;
     glm::vec3 n;
@@ -11,6 +11,9 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "camera_base.h"
 
 #include <vector>
 
@@ -39,8 +42,11 @@ const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
-class Camera
+// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL.
+// The orientation is one quaternion built from the Euler angles, and only when they change: moving
+// along Front/Right/Up does no trigonometry. The view and view-projection matrices are cached and
+// rebuilt on the next Get call after the camera moved (see CameraBase).
+class Camera : public CameraBase
 {
 public:
     // camera Attributes
@@ -49,6 +55,8 @@ public:
     glm::vec3 Up;
     glm::vec3 Right;
     glm::vec3 WorldUp;
+    glm::quat Orientation;
+    // orbit mode: spherical coordinates around Target, Phi measured from WorldUp
     glm::vec3 Target;
     float Distance;
     float Theta;
@@ -63,7 +71,7 @@ public:
     float Zoom;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH, float roll = ROLL) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH, float roll = ROLL) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), Target(glm::vec3(0.0f)), Distance(1.0f), Theta(0.0f), Phi(glm::radians(90.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = position;
         WorldUp = up;
@@ -73,36 +81,60 @@ public:
         updateCameraVectors();
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), Target(glm::vec3(0.0f)), Distance(1.0f), Theta(0.0f), Phi(glm::radians(90.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
         Yaw = yaw;
         Pitch = pitch;
+        Roll = ROLL;
         updateCameraVectors();
     }
+    // starts orbiting around target from where the camera is now
+    void BeginOrbit(glm::vec3 target) {
+        Target = target;
+        glm::vec3 offset = Position - Target;
+        Distance = glm::max(glm::length(offset), 0.1f);
+        Theta = atan2(offset.x, offset.z);
+        Phi = glm::clamp(acos(glm::clamp(offset.y / Distance, -1.0f, 1.0f)), 0.1f, glm::radians(179.9f));
+        Orbit(0.0f, 0.0f);
+    }
+    // moves the camera on its sphere around Target and turns it to look at Target
     void Orbit(float dTheta, float dPhi) {
-        Target = GetViewMatrix()[3];
-        Distance = glm::distance(Target, Position);
         Theta += dTheta;
         Phi = glm::clamp(Phi + dPhi, 0.1f, glm::radians(179.9f));  // Avoids gimbal lock
+        Position = GetPosition();
+        glm::vec3 direction = glm::normalize(Target - Position);
+        Yaw = glm::degrees(atan2(direction.z, direction.x));
+        Pitch = glm::degrees(asin(direction.y));
+        Roll = 0.0f;
+        updateCameraVectors();
+    }
+    // jumps to a position and orientation, Euler angles in degrees
+    void SetPose(glm::vec3 position, float yaw, float pitch, float roll) {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        Roll = roll;
+        updateCameraVectors();
     }
-    // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix()
+    glm::vec3 GetEyePosition() const
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        return Position;
     }
+    // point on the orbit sphere for the current Theta and Phi
     glm::vec3 GetPosition() const {
-        float x = Distance * sin(Phi) * cos(Theta);
-        float y = Distance * sin(Phi) * sin(Theta);
-        float z = Distance * cos(Phi);
+        float x = Distance * sin(Phi) * sin(Theta);
+        float y = Distance * cos(Phi);
+        float z = Distance * sin(Phi) * cos(Theta);
         return Target + glm::vec3(x, y, z);
     }
     glm::mat4 GetViewMatrixOrbit() const {
-        return glm::lookAt(GetPosition(), Target, glm::vec3(0.0f, 1.0f, 0.0f));
+        return glm::lookAt(GetPosition(), Target, WorldUp);
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
+    // Moving only changes Position; the orientation is rebuilt for the turning directions.
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
         float velocity = MovementSpeed * deltaTime;
@@ -118,6 +150,8 @@ public:
             Position += Up * velocity;
         if (direction == DOWN)
             Position -= Up * velocity;
+        if (direction < P_UP)
+            return;
         if (direction == P_UP)
             Pitch += velocity * 10;
         if (direction == P_DOWN)
@@ -165,25 +199,34 @@ public:
             Zoom = 45.0f;
     }
 
+protected:
+    // the view matrix straight from the basis, same as lookAt(Position, Position + Front, Up)
+    glm::mat4 buildViewMatrix()
+    {
+        glm::mat4 view(1.0f);
+        view[0] = glm::vec4(Right.x, Up.x, -Front.x, 0.0f);
+        view[1] = glm::vec4(Right.y, Up.y, -Front.y, 0.0f);
+        view[2] = glm::vec4(Right.z, Up.z, -Front.z, 0.0f);
+        view[3] = glm::vec4(-glm::dot(Right, Position), -glm::dot(Up, Position), glm::dot(Front, Position), 1.0f);
+        return view;
+    }
+
 private:
-    // calculates the front vector from the Camera's (updated) Euler Angles
+
+    // calculates Orientation and the Front, Right and Up vectors from the Camera's (updated) Euler Angles:
+    // yaw turns around the world up axis (-90 looks down -z), pitch around the camera's right axis and
+    // roll around its front axis, the same as the yaw/pitch front vector rolled about itself
     void updateCameraVectors()
     {
-        // calculate the new Front vector
-        glm::vec3 front;
-        glm::mat4 rotationMatrix;
-        front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        front.y = sin(glm::radians(Pitch));
-        front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        Front = glm::normalize(front);
-        // also re-calculate the Right and Up vector
-        Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
-        Up = glm::normalize(glm::cross(Right, Front));
-        if (Roll != 0.0f) {
-            rotationMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(Roll), Front);
-            Up = glm::normalize(glm::vec3(rotationMatrix * glm::vec4(Up, 0.0f)));
-            Right = glm::normalize(glm::cross(Front, Up));
-        }
+        glm::quat yaw = glm::angleAxis(glm::radians(-90.0f - Yaw), WorldUp);
+        glm::quat pitch = glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        glm::quat roll = glm::angleAxis(glm::radians(Roll), glm::vec3(0.0f, 0.0f, -1.0f));
+        Orientation = yaw * pitch * roll;
+        glm::mat3 basis = glm::mat3_cast(Orientation);
+        Right = basis[0];
+        Up = basis[1];
+        Front = -basis[2];
+        invalidateView();
     }
 };
 #endif
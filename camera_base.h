@@ -0,0 +1,130 @@
+//
+//  camera_base.h
+//  3D Object Drawing
+//
+
+#ifndef CAMERA_BASE_H
+#define CAMERA_BASE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum.h"
+
+// Perspective for reverse-Z with depth mapped to [0, 1] (glClipControl GL_ZERO_TO_ONE): depth is 1
+// on the near plane and falls towards 0 at infinity, so there is no far plane. The frustum planes
+// taken from it stay valid: the near pair both end up on the near plane side, nothing is clipped far.
+inline glm::mat4 reverseInfinitePerspective(float fovy, float aspect, float nearPlane)
+{
+    float f = 1.0f / tan(fovy * 0.5f);
+    glm::mat4 projection(0.0f);
+    projection[0][0] = f / aspect;
+    projection[1][1] = f;
+    projection[2][3] = -1.0f;
+    projection[3][2] = nearPlane;
+    return projection;
+}
+
+// What every camera provides: view and projection matrices, their product and its frustum
+// planes. Each one is rebuilt on first use after something it depends on changed, so the
+// culling, shadow and picking code of a frame share one computation. Cameras implement
+// buildViewMatrix() and call invalidateView() when their orientation changes; a moved eye
+// position is noticed on its own.
+class CameraBase
+{
+public:
+    virtual ~CameraBase() {}
+
+    virtual glm::vec3 GetEyePosition() const = 0;
+
+    // reverse-Z projection (see reverseInfinitePerspective); the far plane is ignored while it is on
+    void SetReverseZ(bool enabled)
+    {
+        if (enabled != reverseZ)
+        {
+            reverseZ = enabled;
+            projectionDirty = true;
+        }
+    }
+
+    // vertical field of view in degrees; nothing is rebuilt when the values did not change
+    void SetPerspective(float fovy, float aspect, float nearPlane, float farPlane)
+    {
+        glm::vec4 parameters(fovy, aspect, nearPlane, farPlane);
+        if (parameters != perspective)
+        {
+            perspective = parameters;
+            projectionDirty = true;
+        }
+    }
+
+    const glm::mat4& GetViewMatrix()
+    {
+        glm::vec3 eye = GetEyePosition();
+        if (viewDirty || eye != viewEye)
+        {
+            view = buildViewMatrix();
+            viewEye = eye;
+            viewDirty = false;
+            viewProjectionDirty = true;
+        }
+        return view;
+    }
+
+    const glm::mat4& GetProjectionMatrix()
+    {
+        if (projectionDirty)
+        {
+            if (reverseZ)
+                projection = reverseInfinitePerspective(glm::radians(perspective.x), perspective.y, perspective.z);
+            else
+                projection = glm::perspective(glm::radians(perspective.x), perspective.y, perspective.z, perspective.w);
+            projectionDirty = false;
+            viewProjectionDirty = true;
+        }
+        return projection;
+    }
+
+    const glm::mat4& GetViewProjectionMatrix()
+    {
+        GetViewMatrix();
+        GetProjectionMatrix();
+        if (viewProjectionDirty)
+        {
+            viewProjection = projection * view;
+            frustum.set(viewProjection);
+            viewProjectionDirty = false;
+        }
+        return viewProjection;
+    }
+
+    const Frustum& GetFrustum()
+    {
+        GetViewProjectionMatrix();
+        return frustum;
+    }
+
+protected:
+    CameraBase() : perspective(45.0f, 4.0f / 3.0f, 0.1f, 100.0f), reverseZ(false), viewDirty(true), projectionDirty(true), viewProjectionDirty(true) {}
+
+    virtual glm::mat4 buildViewMatrix() = 0;
+
+    void invalidateView()
+    {
+        viewDirty = true;
+    }
+
+private:
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    Frustum frustum;
+    glm::vec3 viewEye;
+    glm::vec4 perspective;      // fovy, aspect, near, far
+    bool reverseZ;
+    bool viewDirty;
+    bool projectionDirty;
+    bool viewProjectionDirty;
+};
+
+#endif
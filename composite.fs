@@ -0,0 +1,103 @@
+#version 330 core
+
+// Everything between the main pass and the window in one full-screen pass (see post_process.h).
+// The features are compiled in or out, one program per combination: TONEMAP, FXAA and BLOOM.
+#define BLOOM_FIRST_LEVEL 2
+#define BLOOM_LEVELS 4
+
+uniform sampler2D sceneColor;       // HDR color of the main pass, with mips for BLOOM
+uniform vec2 texelSize;             // 1 / its size
+uniform float exposure;
+uniform float bloomStrength;
+uniform float bloomThreshold;
+
+in vec2 TexCoord;
+
+out vec4 FragColor;
+
+// HDR color to display color
+vec3 tonemap(vec3 color)
+{
+#ifdef TONEMAP
+    // ACES filmic curve (Narkowicz's fit)
+    vec3 x = color * exposure;
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+#else
+    return clamp(color, 0.0, 1.0);
+#endif
+}
+
+vec3 fetch(vec2 uv)
+{
+    return tonemap(textureLod(sceneColor, uv, 0.0).rgb);
+}
+
+#ifdef FXAA
+const float FXAA_EDGE_THRESHOLD = 1.0 / 8.0;    // luma contrast, relative to the brightest neighbour, that is an edge
+const float FXAA_EDGE_MIN = 1.0 / 16.0;         // no edge below this contrast, keeps dark areas from being blurred
+const float FXAA_REDUCE_MUL = 1.0 / 8.0;
+const float FXAA_REDUCE_MIN = 1.0 / 128.0;
+const float FXAA_SPAN_MAX = 8.0;                // texels searched along the edge
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// FXAA on the tonemapped color: the diagonal neighbours give the direction across the edge,
+// and two or four taps along the edge blend it. Pixels without contrast keep the center tap,
+// which is most of the screen.
+vec3 antialiased(vec2 uv)
+{
+    vec3 center = fetch(uv);
+    float lumaNW = luma(fetch(uv + vec2(-1.0, -1.0) * texelSize));
+    float lumaNE = luma(fetch(uv + vec2(1.0, -1.0) * texelSize));
+    float lumaSW = luma(fetch(uv + vec2(-1.0, 1.0) * texelSize));
+    float lumaSE = luma(fetch(uv + vec2(1.0, 1.0) * texelSize));
+    float lumaM = luma(center);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if (lumaMax - lumaMin < max(FXAA_EDGE_MIN, lumaMax * FXAA_EDGE_THRESHOLD))
+        return center;
+
+    vec2 direction = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float reduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+    float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+    direction = clamp(direction * scale, -FXAA_SPAN_MAX, FXAA_SPAN_MAX) * texelSize;
+
+    vec3 inner = 0.5 * (fetch(uv + direction * (1.0 / 3.0 - 0.5)) + fetch(uv + direction * (2.0 / 3.0 - 0.5)));
+    vec3 outer = 0.5 * inner + 0.25 * (fetch(uv - direction * 0.5) + fetch(uv + direction * 0.5));
+    float lumaOuter = luma(outer);
+    // the outer taps ran past the end of the edge
+    if (lumaOuter < lumaMin || lumaOuter > lumaMax)
+        return inner;
+    return outer;
+}
+#endif
+
+#ifdef BLOOM
+// Light above the threshold, spread wide: the mips of the scene color are box filtered, each
+// level twice as wide as the one before, so one bilinear tap per level stands in for a chain
+// of blur passes.
+vec3 bloom(vec2 uv)
+{
+    vec3 sum = vec3(0.0);
+    for (int level = BLOOM_FIRST_LEVEL; level < BLOOM_FIRST_LEVEL + BLOOM_LEVELS; level++)
+        sum += max(textureLod(sceneColor, uv, float(level)).rgb - bloomThreshold, 0.0);
+    return sum * (bloomStrength / float(BLOOM_LEVELS));
+}
+#endif
+
+void main()
+{
+#ifdef FXAA
+    vec3 color = antialiased(TexCoord);
+#else
+    vec3 color = fetch(TexCoord);
+#endif
+#ifdef BLOOM
+    // screen blend: the glow brightens without clipping what is already bright
+    color = 1.0 - (1.0 - color) * (1.0 - tonemap(bloom(TexCoord)));
+#endif
+    FragColor = vec4(color, 1.0);
+}
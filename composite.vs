@@ -0,0 +1,12 @@
+#version 330 core
+
+out vec2 TexCoord;
+
+void main()
+{
+    // one triangle over the whole screen, no vertex buffer: vertices 0, 1, 2 land on
+    // (0, 0), (2, 0) and (0, 2) in texture coordinates
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoord = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
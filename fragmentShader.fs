@@ -1,9 +1,120 @@
 #version 330 core
-uniform vec3 color;
+#define NUM_CASCADES 3
 
+// surface textures: every texture is a region of one array (see texture_atlas.h), projected
+// along the dominant axis of each face (the cubes have no UVs) and repeated inside its region
+uniform bool texturesReady;
+uniform sampler2DArray diffuseAtlas;
+
+// lighting
+uniform float ambient;
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+uniform vec3 spotPosition;
+uniform vec3 spotDirection;
+uniform vec3 spotColor;
+uniform float spotInnerCutoff;
+uniform float spotOuterCutoff;
+
+// shadows: static casters are cached, dynamic casters are re-rendered every frame
+uniform bool shadowsEnabled;
+uniform mat4 sunLightSpace[NUM_CASCADES];
+uniform float cascadeSplits[NUM_CASCADES];
+uniform sampler2DArrayShadow sunStaticShadow;
+uniform sampler2DArrayShadow sunDynamicShadow;
+uniform mat4 spotLightSpace;
+uniform sampler2DArrayShadow spotStaticShadow;
+uniform sampler2DArrayShadow spotDynamicShadow;
+
+in vec3 FragPos;
+in float ViewDepth;
+in vec3 SurfaceColor;
+flat in float TextureLayer;
+flat in vec4 AtlasRect;
+flat in float TextureScale;
+flat in float Selected;
+flat in float Opacity;
+
+#ifdef TRANSPARENT
+// weighted blended OIT (see transparency.h): the lit color goes into the accumulation targets
+layout (location = 0) out vec4 Accumulation;
+layout (location = 1) out float AccumulatedWeight;
+vec3 FragColor;
+#else
 out vec3 FragColor;
+#endif
+
+float shadowFactor(sampler2DArrayShadow staticMap, sampler2DArrayShadow dynamicMap, vec4 lightSpacePos, float layer, float bias)
+{
+    vec3 proj = lightSpacePos.xyz / lightSpacePos.w * 0.5 + 0.5;
+    if (proj.z > 1.0)
+        return 1.0;
+    vec4 coord = vec4(proj.xy, layer, proj.z - bias);
+    return min(texture(staticMap, coord), texture(dynamicMap, coord));
+}
 
 void main()
 {
-    FragColor = color;
+    // the cube meshes carry no normals, so use the flat face normal
+    vec3 normal = normalize(cross(dFdx(FragPos), dFdy(FragPos)));
+
+    // sun through the window, cascade chosen by view depth
+    vec3 L = normalize(-sunDirection);
+    float sunDiffuse = max(dot(normal, L), 0.0);
+    float sunShadow = 1.0;
+    if (shadowsEnabled && sunDiffuse > 0.0)
+    {
+        int cascade = NUM_CASCADES - 1;
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            if (ViewDepth < cascadeSplits[i])
+            {
+                cascade = i;
+                break;
+            }
+        }
+        float bias = max(0.002 * (1.0 - dot(normal, L)), 0.0005);
+        if (ViewDepth < cascadeSplits[NUM_CASCADES - 1])
+            sunShadow = shadowFactor(sunStaticShadow, sunDynamicShadow, sunLightSpace[cascade] * vec4(FragPos, 1.0), float(cascade), bias);
+    }
+
+    // ceiling spot light
+    vec3 toSpot = spotPosition - FragPos;
+    float spotDistance = length(toSpot);
+    toSpot /= spotDistance;
+    float spotDiffuse = max(dot(normal, toSpot), 0.0);
+    float cone = clamp((dot(-toSpot, normalize(spotDirection)) - spotOuterCutoff) / (spotInnerCutoff - spotOuterCutoff), 0.0, 1.0);
+    float attenuation = 1.0 / (1.0 + 0.09 * spotDistance + 0.032 * spotDistance * spotDistance);
+    float spotShadow = 1.0;
+    if (shadowsEnabled && spotDiffuse * cone > 0.0)
+    {
+        float bias = max(0.0005 * (1.0 - dot(normal, toSpot)), 0.0001);
+        spotShadow = shadowFactor(spotStaticShadow, spotDynamicShadow, spotLightSpace * vec4(FragPos, 1.0), 0.0, bias);
+    }
+
+    vec3 albedo = SurfaceColor;
+    if (texturesReady && TextureLayer >= 0.0)
+    {
+        vec3 axis = abs(normal);
+        vec2 uv = (axis.x > axis.y && axis.x > axis.z) ? FragPos.zy : ((axis.y > axis.z) ? FragPos.xz : FragPos.xy);
+        uv *= TextureScale;
+        // wrap by hand inside the region; gradients of the unwrapped uv keep the mip choice seamless
+        vec2 halfTexel = 0.5 / (vec2(textureSize(diffuseAtlas, 0).xy) * AtlasRect.zw);
+        vec2 atlasUV = AtlasRect.xy + clamp(fract(uv), halfTexel, 1.0 - halfTexel) * AtlasRect.zw;
+        albedo *= textureGrad(diffuseAtlas, vec3(atlasUV, TextureLayer), dFdx(uv) * AtlasRect.zw, dFdy(uv) * AtlasRect.zw).rgb;
+    }
+
+    vec3 light = vec3(ambient)
+        + sunColor * sunDiffuse * sunShadow
+        + spotColor * spotDiffuse * cone * attenuation * spotShadow;
+    FragColor = albedo * light;
+    // the selected furniture is tinted
+    FragColor = mix(FragColor, vec3(1.0, 0.75, 0.2), 0.35 * Selected);
+#ifdef TRANSPARENT
+    // nearer layers count for more (McGuire and Bavoil's depth weight), so the front glass
+    // dominates where layers overlap without sorting them
+    float weight = Opacity * clamp(10.0 / (1e-5 + pow(ViewDepth / 5.0, 2.0) + pow(ViewDepth / 200.0, 6.0)), 1e-2, 3e3);
+    Accumulation = vec4(FragColor * weight, Opacity);
+    AccumulatedWeight = weight;
+#endif
 }
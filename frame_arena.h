@@ -0,0 +1,222 @@
+//
+//  frame_arena.h
+//  3D Object Drawing
+//
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <atomic>
+
+// Default arena values
+const size_t FRAME_ARENA_SIZE = 256u * 1024u;       // bytes each thread's arena starts with
+const size_t FRAME_ARENA_ALIGNMENT = 16u;           // largest alignment allocate() can give
+
+
+// Linear allocator for data that only lives until the end of a frame: visibility lists, draw
+// lists, sort orders. allocate() moves an offset through one block and nothing is freed on
+// its own; reset() takes the offset back to 0, so a whole frame is released in O(1). A frame
+// that does not fit spills into extra blocks chained behind the first; the next reset() frees
+// them and grows the first block to the size that frame needed, so after a frame or two at the
+// peak size the arena stops touching the heap altogether.
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t capacity = FRAME_ARENA_SIZE)
+        : Peak(0), block(NULL), capacity(0), offset(0), spill(NULL), spillBytes(0)
+    {
+        grow(capacity);
+    }
+
+    ~FrameArena()
+    {
+        freeSpill();
+        ::operator delete(block);
+    }
+
+    size_t Peak;            // most bytes a frame has used since the arena was made
+
+    void* allocate(size_t bytes, size_t alignment = FRAME_ARENA_ALIGNMENT)
+    {
+        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= capacity)
+        {
+            offset = start + bytes;
+            return block + start;
+        }
+        // over the block for this frame: a separate block, freed by the next reset
+        Spill* extra = (Spill*)::operator new(sizeof(Spill) + bytes);
+        extra->next = spill;
+        spill = extra;
+        spillBytes += bytes + alignment;
+        return extra + 1;
+    }
+
+    template <class T>
+    T* allocateArray(size_t count)
+    {
+        return (T*)allocate(count * sizeof(T), alignof(T));
+    }
+
+    // every allocation of the frame is gone after this
+    void reset()
+    {
+        size_t used = offset + spillBytes;
+        if (used > Peak)
+            Peak = used;
+        if (spill != NULL)
+        {
+            freeSpill();
+            grow(used + used / 2);
+        }
+        offset = 0;
+    }
+
+    size_t used() const
+    {
+        return offset + spillBytes;
+    }
+
+private:
+    struct Spill
+    {
+        Spill* next;
+        void* padding;      // keeps the data after the header at 16 bytes
+    };
+
+    unsigned char* block;
+    size_t capacity;
+    size_t offset;
+    Spill* spill;
+    size_t spillBytes;
+
+    void grow(size_t bytes)
+    {
+        ::operator delete(block);
+        capacity = (bytes + FRAME_ARENA_ALIGNMENT - 1) & ~(FRAME_ARENA_ALIGNMENT - 1);
+        block = (unsigned char*)::operator new(capacity);
+    }
+
+    void freeSpill()
+    {
+        while (spill != NULL)
+        {
+            Spill* next = spill->next;
+            ::operator delete(spill);
+            spill = next;
+        }
+        spillBytes = 0;
+    }
+
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+};
+
+// The arena of the calling thread. Each thread that builds per-frame data (the GL thread, the
+// simulation thread, workers) gets its own, so allocating never locks; each one calls reset()
+// on its own arena at the end of its frame or job, when no container using it is alive.
+inline FrameArena& frameArena()
+{
+    static thread_local FrameArena arena;
+    return arena;
+}
+
+// Standard allocator on a FrameArena: deallocate() does nothing, the memory comes back with
+// the arena's reset(). A container grown on it wastes what it grew out of, so reserve() first
+// where the size is known.
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(FrameArena& frameArena) : arena(&frameArena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count)
+    {
+        return arena->allocateArray<T>(count);
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return arena != other.arena;
+    }
+
+private:
+    template <class U> friend class ArenaAllocator;
+    FrameArena* arena;
+};
+
+// vector for per-frame lists: FrameVector<int> list(frameArena());
+template <class T>
+using FrameVector = std::vector<T, ArenaAllocator<T> >;
+
+// Counts the calls to the global operator new, for checking that steady-state frames do not
+// touch the heap (see --count-allocations). main.cpp replaces operator new to bump it.
+inline std::atomic<size_t>& heapAllocations()
+{
+    static std::atomic<size_t> count(0);
+    return count;
+}
+
+// Subsystems the live heap bytes are counted by (see Telemetry): an allocation counts against
+// the tag of the innermost HeapScope of its thread, HEAP_OTHER outside of any
+enum HeapTag
+{
+    HEAP_OTHER,
+    HEAP_RENDER,                // the GL thread's frames
+    HEAP_SIMULATION,            // the simulation thread
+    HEAP_SCENE,                 // scene file parsing and world partition cell builds
+    HEAP_STREAMING,             // texture file reads
+    HEAP_TAG_COUNT
+};
+
+// Bytes live on the heap per HeapTag. main.cpp's operator new keeps the size and tag of every
+// block in a header in front of it, so operator delete takes the bytes off the tag they were
+// allocated under, whichever thread frees them.
+inline std::atomic<int64_t>* heapBytes()
+{
+    static std::atomic<int64_t> bytes[HEAP_TAG_COUNT];
+    return bytes;
+}
+
+inline HeapTag& heapTag()
+{
+    static thread_local HeapTag tag = HEAP_OTHER;
+    return tag;
+}
+
+// counts the heap allocations of this thread against tag while it is in scope
+class HeapScope
+{
+public:
+    explicit HeapScope(HeapTag tag) : previous(heapTag())
+    {
+        heapTag() = tag;
+    }
+
+    ~HeapScope()
+    {
+        heapTag() = previous;
+    }
+
+private:
+    HeapTag previous;
+};
+
+#endif
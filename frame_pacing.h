@@ -0,0 +1,207 @@
+//
+//  frame_pacing.h
+//  3D Object Drawing
+//
+
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// Default frame pacing values
+const double FRAME_LIMITER_SPIN = 0.002;        // seconds before a deadline spent spinning instead of sleeping
+const int LATENCY_QUERIES = 8;                  // frames whose swap time can be in flight
+const double LATENCY_CALIBRATE_SECONDS = 1.0;   // how often the GPU clock is matched to the CPU one again
+const GLuint64 LATENCY_WAIT_TIMEOUT = 100000000; // nanoseconds the low-latency wait gives the GPU
+
+
+// Swap interval for a vsync setting: "on" waits for the vertical blank, "off" never does,
+// "adaptive" waits unless the frame is already late (a late frame tears instead of waiting a
+// whole extra refresh; needs EXT_swap_control_tear, plain vsync without it) and "driver"
+// leaves whatever the driver defaults to, which is why it is not the default setting.
+// Needs the window's context current.
+inline void setVsync(const std::string& mode)
+{
+    if (mode == "on")
+        glfwSwapInterval(1);
+    else if (mode == "off")
+        glfwSwapInterval(0);
+    else if (mode == "adaptive")
+    {
+        bool tear = glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear");
+        if (!tear)
+            std::cout << "EXT_swap_control_tear not available, adaptive vsync falls back to vsync on" << std::endl;
+        glfwSwapInterval(tear ? -1 : 1);
+    }
+}
+
+// Holds frames to a fixed rate. A sleep alone overshoots by the scheduler's granularity (a
+// millisecond or more, far more with Windows' default timer), so wait() sleeps until
+// FRAME_LIMITER_SPIN before the deadline and yields in a loop for the rest. Deadlines are a
+// period apart rather than a period after the last wait, so the rate does not drift; a frame
+// that ran over a whole period starts the schedule over instead of rushing to catch up.
+class FrameLimiter
+{
+public:
+    explicit FrameLimiter(double framesPerSecond = 0.0) : started(false)
+    {
+        setRate(framesPerSecond);
+    }
+
+    // 0 turns the limiter off
+    void setRate(double framesPerSecond)
+    {
+        period = std::chrono::duration<double>(framesPerSecond > 0.0 ? 1.0 / framesPerSecond : 0.0);
+        started = false;
+    }
+
+    void wait()
+    {
+        if (period.count() <= 0.0)
+            return;
+        Clock::time_point now = Clock::now();
+        if (!started || now - deadline > period)
+        {
+            deadline = now;
+            started = true;
+        }
+        else
+        {
+            Clock::time_point wake = deadline - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(FRAME_LIMITER_SPIN));
+            if (wake > now)
+                std::this_thread::sleep_until(wake);
+            while (Clock::now() < deadline)
+                std::this_thread::yield();
+        }
+        deadline += std::chrono::duration_cast<Clock::duration>(period);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    std::chrono::duration<double> period;
+    Clock::time_point deadline;
+    bool started;
+};
+
+// Input-to-photon latency per frame: from the oldest input event a frame used to the moment the
+// GPU finished that frame's swap. The swap time comes from a GL_TIMESTAMP query issued right
+// after glfwSwapBuffers, moved onto the glfwGetTime() clock by comparing the two clocks every
+// LATENCY_CALIBRATE_SECONDS. Scan-out after the swap (up to one refresh) and the time between
+// the OS receiving an event and glfwPollEvents handing it over are not visible to GL and not
+// included. Results arrive a few frames late, without stalling. waitForGpu() is the low-latency
+// mode: the CPU waits on a fence until the frame is done, so no frames queue up in the driver
+// and the next frame samples input as late as possible.
+// GL thread: swapped() after every swap, poll() once a frame.
+class LatencyMeter
+{
+public:
+    float LastMs;               // newest frame with input
+    double TotalMs;
+    float MaxMs;
+    int Frames;                 // frames measured
+
+    LatencyMeter() : LastMs(0.0f), TotalMs(0.0), MaxMs(0.0f), Frames(0), next(0), oldest(0), pending(0), offset(0.0), calibrated(-1.0)
+    {
+        for (int i = 0; i < LATENCY_QUERIES; i++)
+            queries[i] = 0;
+    }
+
+    // writes "<frame> <latency ms>" for every measured frame
+    bool log(const std::string& path)
+    {
+        file.open(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::LATENCY::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // after glfwSwapBuffers of frame `frame`; inputTime is the glfwGetTime() of its oldest input event, < 0 for none
+    void swapped(int frame, double inputTime)
+    {
+        if (queries[0] == 0)
+            glGenQueries(LATENCY_QUERIES, queries);
+        double now = glfwGetTime();
+        if (calibrated < 0.0 || now - calibrated > LATENCY_CALIBRATE_SECONDS)
+        {
+            GLint64 gpuNow = 0;
+            glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+            offset = glfwGetTime() - gpuNow * 1e-9;
+            calibrated = now;
+        }
+        if (inputTime < 0.0 || pending == LATENCY_QUERIES)
+            return;
+        glQueryCounter(queries[next], GL_TIMESTAMP);
+        frames[next] = frame;
+        inputTimes[next] = inputTime;
+        next = (next + 1) % LATENCY_QUERIES;
+        pending++;
+    }
+
+    // low-latency mode: blocks until the GPU has finished everything submitted so far
+    void waitForGpu()
+    {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, LATENCY_WAIT_TIMEOUT);
+        glDeleteSync(fence);
+    }
+
+    // takes in the finished measurements
+    void poll()
+    {
+        while (pending > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &nanoseconds);
+            LastMs = (float)(1000.0 * (nanoseconds * 1e-9 + offset - inputTimes[oldest]));
+            TotalMs += LastMs;
+            MaxMs = std::max(MaxMs, LastMs);
+            Frames++;
+            if (file.is_open())
+                file << frames[oldest] << " " << LastMs << "\n";
+            oldest = (oldest + 1) % LATENCY_QUERIES;
+            pending--;
+        }
+    }
+
+    float averageMs() const
+    {
+        return Frames > 0 ? (float)(TotalMs / Frames) : 0.0f;
+    }
+
+    void release()
+    {
+        if (queries[0] != 0)
+            glDeleteQueries(LATENCY_QUERIES, queries);
+        for (int i = 0; i < LATENCY_QUERIES; i++)
+            queries[i] = 0;
+        next = oldest = pending = 0;
+    }
+
+private:
+    GLuint queries[LATENCY_QUERIES];
+    int frames[LATENCY_QUERIES];
+    double inputTimes[LATENCY_QUERIES];
+    int next;
+    int oldest;
+    int pending;
+    double offset;              // glfwGetTime() minus GPU time in seconds
+    double calibrated;          // glfwGetTime() of the last calibration
+    std::ofstream file;
+};
+
+#endif
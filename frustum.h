@@ -0,0 +1,56 @@
+//
+//  frustum.h
+//  3D Object Drawing
+//
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// The six clip planes of a view-projection (or light-space) matrix, used to cull
+// world-space boxes. Planes point inwards and are normalized. The side planes can be
+// pulled in to a rectangle of normalized device coordinates (x0, y0, x1, y1), which is
+// how portal traversal narrows the view through a doorway.
+struct Frustum
+{
+    glm::vec4 Planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& viewProjection, const glm::vec4& ndcRect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f))
+    {
+        set(viewProjection, ndcRect);
+    }
+
+    void set(const glm::mat4& m, const glm::vec4& ndcRect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f))
+    {
+        // rows of the matrix (glm stores columns)
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        Planes[0] = row[0] - ndcRect.x * row[3];    // left
+        Planes[1] = ndcRect.z * row[3] - row[0];    // right
+        Planes[2] = row[1] - ndcRect.y * row[3];    // bottom
+        Planes[3] = ndcRect.w * row[3] - row[1];    // top
+        Planes[4] = row[3] + row[2];    // near
+        Planes[5] = row[3] - row[2];    // far
+        for (int i = 0; i < 6; i++)
+            Planes[i] /= glm::length(glm::vec3(Planes[i]));
+    }
+
+    // false only when the box lies completely outside one of the planes
+    bool intersects(const glm::vec3& center, const glm::vec3& halfSize) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            glm::vec3 normal = glm::vec3(Planes[i]);
+            float radius = glm::dot(halfSize, glm::abs(normal));
+            if (glm::dot(normal, center) + Planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,326 @@
+//
+//  golden.h
+//  3D Object Drawing
+//
+
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// Default golden image values
+const std::string GOLDEN_POSES_PATH = "scenes/golden.poses";
+const int GOLDEN_SETTLE_FRAMES = 60;            // frames per pose before timing, for cells and mips to stream in
+const int GOLDEN_TIMED_FRAMES = 30;             // frames per pose the frame time is averaged over; the last is compared
+const float GOLDEN_DELTA_E = 5.0f;              // CIE76 difference a pixel may have before it counts as changed
+const float GOLDEN_MAX_CHANGED = 0.002f;        // fraction of changed pixels a pose may have
+const float GOLDEN_TIME_TOLERANCE = 0.25f;      // frame time over the stored one before a pose fails
+const float GOLDEN_TIME_NOISE_MS = 0.5f;        // differences below this never fail
+const std::string FLYTHROUGH_POSES_PATH = "scenes/flythrough.poses";
+const float FLYTHROUGH_SECONDS_PER_POSE = 2.0f; // flight time from one pose to the next
+
+
+// RGB8 image, top row first, read and written as binary PPM
+struct RgbImage
+{
+    int Width;
+    int Height;
+    std::vector<unsigned char> Pixels;
+
+    RgbImage() : Width(0), Height(0) {}
+
+    bool read(const std::string& path)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        std::string magic;
+        int maxValue = 0;
+        if (!(file >> magic >> Width >> Height >> maxValue) || magic != "P6" || maxValue != 255)
+            return false;
+        file.get();
+        Pixels.resize((size_t)Width * Height * 3);
+        return (bool)file.read((char*)Pixels.data(), Pixels.size());
+    }
+
+    bool write(const std::string& path) const
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::GOLDEN::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        file << "P6\n" << Width << " " << Height << "\n255\n";
+        file.write((const char*)Pixels.data(), Pixels.size());
+        return true;
+    }
+
+    // the color attachment of the bound read framebuffer
+    void readFramebuffer(int width, int height)
+    {
+        Width = width;
+        Height = height;
+        Pixels.resize((size_t)width * height * 3);
+        std::vector<unsigned char> bottomUp(Pixels.size());
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, bottomUp.data());
+        for (int y = 0; y < height; y++)
+            std::copy(bottomUp.begin() + (size_t)(height - 1 - y) * width * 3, bottomUp.begin() + (size_t)(height - y) * width * 3,
+                Pixels.begin() + (size_t)y * width * 3);
+    }
+};
+
+struct ImageDifference
+{
+    float MaxDelta;         // largest CIE76 difference left after the neighbour search
+    float Changed;          // fraction of pixels over GOLDEN_DELTA_E
+};
+
+// Perceptual difference of two images of the same size: colors are compared in CIELAB, where
+// equal distances look about equally different, and each pixel is matched against the closest
+// of the golden pixels within one pixel of it, so an edge that moved by a pixel (a different
+// driver's rasterization rules) does not count as changed.
+inline ImageDifference compareImages(const RgbImage& image, const RgbImage& golden)
+{
+    ImageDifference difference = { 0.0f, 1.0f };
+    if (image.Width != golden.Width || image.Height != golden.Height)
+        return difference;
+    std::vector<glm::vec3> lab[2];
+    const RgbImage* images[2] = { &image, &golden };
+    for (int i = 0; i < 2; i++)
+    {
+        lab[i].resize((size_t)image.Width * image.Height);
+        for (size_t p = 0; p < lab[i].size(); p++)
+        {
+            const unsigned char* rgb = &images[i]->Pixels[p * 3];
+            glm::vec3 linear;
+            for (int c = 0; c < 3; c++)
+            {
+                float v = rgb[c] / 255.0f;
+                linear[c] = v <= 0.04045f ? v / 12.92f : pow((v + 0.055f) / 1.055f, 2.4f);
+            }
+            // sRGB to XYZ relative to the D65 white point, then to Lab
+            glm::vec3 xyz(
+                (0.4124f * linear.x + 0.3576f * linear.y + 0.1805f * linear.z) / 0.9505f,
+                0.2126f * linear.x + 0.7152f * linear.y + 0.0722f * linear.z,
+                (0.0193f * linear.x + 0.1192f * linear.y + 0.9505f * linear.z) / 1.089f);
+            for (int c = 0; c < 3; c++)
+                xyz[c] = xyz[c] > 0.008856f ? cbrt(xyz[c]) : 7.787f * xyz[c] + 16.0f / 116.0f;
+            lab[i][p] = glm::vec3(116.0f * xyz.y - 16.0f, 500.0f * (xyz.x - xyz.y), 200.0f * (xyz.y - xyz.z));
+        }
+    }
+    size_t changed = 0;
+    difference.MaxDelta = 0.0f;
+    for (int y = 0; y < image.Height; y++)
+    {
+        for (int x = 0; x < image.Width; x++)
+        {
+            const glm::vec3& color = lab[0][(size_t)y * image.Width + x];
+            float best = 1e30f;
+            for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, image.Height - 1); ny++)
+                for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, image.Width - 1); nx++)
+                    best = std::min(best, glm::length(color - lab[1][(size_t)ny * image.Width + nx]));
+            difference.MaxDelta = std::max(difference.MaxDelta, best);
+            if (best > GOLDEN_DELTA_E)
+                changed++;
+        }
+    }
+    difference.Changed = (float)changed / (image.Width * image.Height);
+    return difference;
+}
+
+// One fixed camera of the golden run
+struct GoldenPose
+{
+    std::string name;
+    glm::vec3 position;
+    float yaw, pitch, roll;
+};
+
+// Reads a poses file:
+//   pose <name> <x> <y> <z> <yaw> <pitch> <roll>      (Camera Position and Euler angles in degrees)
+//   # comment
+inline bool loadPoses(const std::string& path, std::vector<GoldenPose>& poses)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+    {
+        std::cout << "ERROR::GOLDEN::FILE_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#')
+            continue;
+        GoldenPose pose;
+        if (keyword != "pose" || !(words >> pose.name >> pose.position.x >> pose.position.y >> pose.position.z >> pose.yaw >> pose.pitch >> pose.roll))
+        {
+            std::cout << "ERROR::GOLDEN::SYNTAX: " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+        poses.push_back(pose);
+    }
+    return !poses.empty();
+}
+
+// Golden-image regression run: the scene is drawn from every pose of a poses file, each for
+// GOLDEN_SETTLE_FRAMES + GOLDEN_TIMED_FRAMES frames. The last frame of a pose is compared with
+// <directory>/<pose>.ppm and its average frame time with the one in <directory>/times.txt, so
+// one run shows rendering and performance regressions together. With update set the images
+// and times are written instead. A failing pose leaves its frame as <pose>.actual.ppm.
+class GoldenRun
+{
+public:
+    std::vector<GoldenPose> Poses;
+    int Failures;
+
+    GoldenRun() : Failures(0), update(false), frameTime(0.0) {}
+
+    bool load(const std::string& posesPath, const std::string& goldenDirectory, bool updateGolden)
+    {
+        directory = goldenDirectory;
+        update = updateGolden;
+        if (!loadPoses(posesPath, Poses))
+            return false;
+        if (!update)
+        {
+            std::ifstream times((directory + "/times.txt").c_str());
+            std::string name;
+            double milliseconds;
+            while (times >> name >> milliseconds)
+                baseline[name] = milliseconds;
+        }
+        return true;
+    }
+
+    static int framesPerPose()
+    {
+        return GOLDEN_SETTLE_FRAMES + GOLDEN_TIMED_FRAMES;
+    }
+
+    // GL thread, after frame `frame` of pose `pose` has been drawn to the window and finished
+    // (glFinish), with the window framebuffer bound and before the swap; frameStart and now
+    // are glfwGetTime() seconds
+    void endFrame(int pose, int frame, int width, int height, double frameStart, double now)
+    {
+        if (frame < GOLDEN_SETTLE_FRAMES)
+            return;
+        if (frame == GOLDEN_SETTLE_FRAMES)
+            frameTime = 0.0;
+        frameTime += now - frameStart;
+        if (frame + 1 < framesPerPose())
+            return;
+
+        const GoldenPose& current = Poses[pose];
+        double milliseconds = 1000.0 * frameTime / GOLDEN_TIMED_FRAMES;
+        RgbImage image;
+        image.readFramebuffer(width, height);
+        std::string goldenPath = directory + "/" + current.name + ".ppm";
+        if (update)
+        {
+            image.write(goldenPath);
+            std::ofstream times((directory + "/times.txt").c_str(), pose == 0 ? std::ios::trunc : std::ios::app);
+            times << current.name << " " << milliseconds << "\n";
+            std::cout << "golden " << current.name << ": written, " << milliseconds << " ms" << std::endl;
+            return;
+        }
+
+        RgbImage golden;
+        std::cout << "golden " << current.name << ": ";
+        bool passed = true;
+        if (!golden.read(goldenPath))
+        {
+            std::cout << "no golden image, ";
+            passed = false;
+        }
+        else
+        {
+            ImageDifference difference = compareImages(image, golden);
+            std::cout << 100.0f * difference.Changed << "% changed (max delta E " << difference.MaxDelta << "), ";
+            passed = difference.Changed <= GOLDEN_MAX_CHANGED;
+        }
+        std::cout << milliseconds << " ms";
+        if (baseline.count(current.name))
+        {
+            double expected = baseline[current.name];
+            std::cout << " (was " << expected << " ms)";
+            if (milliseconds > expected * (1.0 + GOLDEN_TIME_TOLERANCE) && milliseconds - expected > GOLDEN_TIME_NOISE_MS)
+                passed = false;
+        }
+        std::cout << (passed ? " PASS" : " FAIL") << std::endl;
+        if (!passed)
+        {
+            image.write(directory + "/" + current.name + ".actual.ppm");
+            Failures++;
+        }
+    }
+
+private:
+    std::string directory;
+    bool update;
+    std::map<std::string, double> baseline;
+    double frameTime;
+};
+
+// Scripted camera flight through the poses of a poses file, for runs that need the camera
+// moving the same way every time (profile training, frame times while streaming and culling
+// change): the camera glides from each pose to the next in FLYTHROUGH_SECONDS_PER_POSE, eased
+// in and out, and turns the short way round.
+class Flythrough
+{
+public:
+    std::vector<GoldenPose> Poses;
+
+    bool load(const std::string& path)
+    {
+        Poses.clear();
+        return loadPoses(path, Poses);
+    }
+
+    // the camera `seconds` into the flight; false once it has reached the last pose
+    bool at(float seconds, GoldenPose& pose) const
+    {
+        float legs = seconds / FLYTHROUGH_SECONDS_PER_POSE;
+        int leg = (int)legs;
+        if (leg + 1 >= (int)Poses.size())
+            return false;
+        const GoldenPose& from = Poses[leg];
+        const GoldenPose& to = Poses[leg + 1];
+        float t = legs - leg;
+        t = t * t * (3.0f - 2.0f * t);
+        pose.name = from.name;
+        pose.position = glm::mix(from.position, to.position, t);
+        pose.yaw = from.yaw + turn(from.yaw, to.yaw) * t;
+        pose.pitch = from.pitch + (to.pitch - from.pitch) * t;
+        pose.roll = from.roll + turn(from.roll, to.roll) * t;
+        return true;
+    }
+
+private:
+    // shortest signed turn from a to b in degrees
+    static float turn(float a, float b)
+    {
+        float d = std::fmod(b - a, 360.0f);
+        if (d > 180.0f)
+            d -= 360.0f;
+        else if (d < -180.0f)
+            d += 360.0f;
+        return d;
+    }
+};
+
+#endif
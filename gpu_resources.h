@@ -0,0 +1,492 @@
+//
+//  gpu_resources.h
+//  3D Object Drawing
+//
+
+#ifndef GPU_RESOURCES_H
+#define GPU_RESOURCES_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// Default resource manager values
+const size_t GPU_POOL_PAGE_SIZE = 4u * 1024u * 1024u;   // bytes of each shared buffer a pool suballocates from
+const int GPU_MAX_FENCES = 8;                           // frames of deletions in flight before endFrame() waits
+
+
+enum GpuResourceType
+{
+    GPU_BUFFER,
+    GPU_VERTEX_ARRAY,
+    GPU_TEXTURE,
+    GPU_FRAMEBUFFER,
+    GPU_RENDERBUFFER,
+    GPU_RESOURCE_TYPE_COUNT
+};
+
+// Names a GL object owned by GpuResources. The generation is bumped when the object is
+// destroyed, so a handle kept past that resolves to 0 instead of to whatever reuses the slot.
+struct GpuHandle
+{
+    unsigned int index;
+    unsigned int generation;        // 0 never names a live object
+
+    GpuHandle() : index(0), generation(0) {}
+};
+
+// Part of one of a pool's shared buffers; size 0 means none
+struct GpuRange
+{
+    int pool;
+    int page;
+    size_t offset;
+    size_t size;
+
+    GpuRange() : pool(-1), page(-1), offset(0), size(0) {}
+};
+
+// What one frame sent to the GPU and how often it switched state, for the telemetry
+struct GpuFrameCounters
+{
+    size_t UploadBytes;         // buffer writes and texture uploads
+    int Draws;                  // draw calls; a multi-draw is one
+    int StateChanges;           // program, vertex array and render target binds
+
+    GpuFrameCounters() : UploadBytes(0), Draws(0), StateChanges(0) {}
+};
+
+// First-fit allocator of ranges of [0, Size): only offsets are handed out, the memory is
+// somewhere else. Freed ranges are merged with their free neighbours.
+class OffsetAllocator
+{
+public:
+    size_t Size;
+    size_t Used;
+
+    explicit OffsetAllocator(size_t size = 0) : Size(size), Used(0)
+    {
+        if (size > 0)
+            freeRanges[0] = size;
+    }
+
+    // alignment need not be a power of two: instance ranges are aligned to whole instances
+    bool allocate(size_t size, size_t alignment, size_t& offset)
+    {
+        for (std::map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+        {
+            size_t start = (it->first + alignment - 1) / alignment * alignment;
+            size_t end = it->first + it->second;
+            if (start + size > end)
+                continue;
+            size_t before = it->first;
+            freeRanges.erase(it);
+            if (start > before)
+                freeRanges[before] = start - before;
+            if (start + size < end)
+                freeRanges[start + size] = end - start - size;
+            offset = start;
+            Used += size;
+            return true;
+        }
+        return false;
+    }
+
+    void free(size_t offset, size_t size)
+    {
+        Used -= size;
+        std::map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = freeRanges.erase(next);
+        }
+        if (next != freeRanges.begin())
+        {
+            std::map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset)
+            {
+                previous->second += size;
+                return;
+            }
+        }
+        freeRanges[offset] = size;
+    }
+
+private:
+    std::map<size_t, size_t> freeRanges;    // offset -> size
+};
+
+// Owner of the GL objects of the renderer, GL thread only.
+//  - objects are created and destroyed through generation-checked handles, with their size
+//    recorded per type for report()
+//  - pools hand out ranges of a few large shared buffers (GPU_POOL_PAGE_SIZE each), so
+//    everything drawn from one buffer can share one VAO
+//  - destroy() and free() only retire: the object or range is deleted by the endFrame() that
+//    sees a fence placed after the frame it was retired in, so a range is never handed out
+//    again while the GPU may still be reading the draws of that frame
+//  - release() deletes everything and reports whatever was never destroyed as leaked
+//  - the count*() calls of the draw, bind and upload sites add up to GpuFrameCounters, which
+//    endFrame() hands over to lastFrame()
+class GpuResources
+{
+public:
+    GpuResources() : frame(0), completedFrame(-1), fenceFirst(0), fenceCount(0) {}
+
+    GpuHandle create(GpuResourceType type, const char* label)
+    {
+        GLuint name = 0;
+        switch (type)
+        {
+        case GPU_BUFFER: glGenBuffers(1, &name); break;
+        case GPU_VERTEX_ARRAY: glGenVertexArrays(1, &name); break;
+        case GPU_TEXTURE: glGenTextures(1, &name); break;
+        case GPU_FRAMEBUFFER: glGenFramebuffers(1, &name); break;
+        case GPU_RENDERBUFFER: glGenRenderbuffers(1, &name); break;
+        default: break;
+        }
+        unsigned int index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            index = (unsigned int)slots.size();
+            slots.push_back(Slot());
+            slots.back().generation = 0;
+        }
+        Slot& slot = slots[index];
+        slot.generation++;
+        slot.name = name;
+        slot.type = type;
+        slot.bytes = 0;
+        slot.label = label;
+        GpuHandle handle;
+        handle.index = index;
+        handle.generation = slot.generation;
+        return handle;
+    }
+
+    // the GL name, 0 for a destroyed or never created handle
+    GLuint get(const GpuHandle& handle) const
+    {
+        return live(handle) ? slots[handle.index].name : 0;
+    }
+
+    // records how much memory the object holds, for report()
+    void setBytes(const GpuHandle& handle, size_t bytes)
+    {
+        if (live(handle))
+            slots[handle.index].bytes = bytes;
+    }
+
+    void destroy(GpuHandle& handle)
+    {
+        if (!live(handle))
+            return;
+        Slot& slot = slots[handle.index];
+        Retired retiredObject = { slot.type, slot.name, GpuRange(), frame };
+        retired.push_back(retiredObject);
+        slot.generation++;
+        slot.name = 0;
+        freeSlots.push_back(handle.index);
+        handle = GpuHandle();
+    }
+
+    // a pool of shared buffers; ranges from it start at multiples of alignment
+    int createPool(const char* label, size_t alignment)
+    {
+        Pool pool;
+        pool.label = label;
+        pool.alignment = alignment;
+        pools.push_back(pool);
+        return (int)pools.size() - 1;
+    }
+
+    GpuRange allocate(int pool, size_t bytes)
+    {
+        Pool& p = pools[pool];
+        GpuRange range;
+        range.pool = pool;
+        range.size = bytes;
+        for (size_t i = 0; i < p.pages.size(); i++)
+        {
+            if (p.pages[i].space.allocate(bytes, p.alignment, range.offset))
+            {
+                range.page = (int)i;
+                return range;
+            }
+        }
+        // a new shared buffer; one larger than a page gets a buffer of its own size
+        Page page;
+        size_t size = std::max(GPU_POOL_PAGE_SIZE, bytes);
+        page.buffer = create(GPU_BUFFER, p.label);
+        page.space = OffsetAllocator(size);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, get(page.buffer));
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        setBytes(page.buffer, size);
+        page.space.allocate(bytes, p.alignment, range.offset);
+        p.pages.push_back(page);
+        range.page = (int)p.pages.size() - 1;
+        return range;
+    }
+
+    void free(GpuRange& range)
+    {
+        if (range.size == 0)
+            return;
+        Retired retiredRange = { GPU_RESOURCE_TYPE_COUNT, 0, range, frame };
+        retired.push_back(retiredRange);
+        range = GpuRange();
+    }
+
+    // the shared buffer the range is in
+    GLuint buffer(const GpuRange& range) const
+    {
+        return range.size == 0 ? 0 : get(pools[range.pool].pages[range.page].buffer);
+    }
+
+    GLuint pageBuffer(int pool, int page) const
+    {
+        return get(pools[pool].pages[page].buffer);
+    }
+
+    // bytes of data to offset bytes into the range
+    void write(const GpuRange& range, const void* data, size_t bytes, size_t offset = 0)
+    {
+        if (bytes == 0)
+            return;
+        countUpload(bytes);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer(range));
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset + offset, bytes, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // once per frame after the last draw: fences what was retired this frame and deletes what
+    // the GPU is done with
+    void endFrame()
+    {
+        if (!retired.empty() && retired.back().frame == frame)
+        {
+            if (fenceCount == GPU_MAX_FENCES)
+            {
+                // the oldest fence's ranges are only reused once it has signaled, however long that takes
+                GLenum status;
+                do
+                    status = glClientWaitSync(fences[fenceFirst].sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+                while (status == GL_TIMEOUT_EXPIRED);
+                if (status == GL_WAIT_FAILED)
+                    glFinish();
+                popFence();
+            }
+            Fence& fence = fences[(fenceFirst + fenceCount) % GPU_MAX_FENCES];
+            fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            fence.frame = frame;
+            fenceCount++;
+        }
+        while (fenceCount > 0)
+        {
+            GLenum status = glClientWaitSync(fences[fenceFirst].sync, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            popFence();
+        }
+        deleteRetired(completedFrame);
+        frame++;
+        finished = counters;
+        counters = GpuFrameCounters();
+    }
+
+    void countUpload(size_t bytes)
+    {
+        counters.UploadBytes += bytes;
+    }
+
+    void countDraw()
+    {
+        counters.Draws++;
+    }
+
+    void countStateChange()
+    {
+        counters.StateChanges++;
+    }
+
+    // the counters of the frame the last endFrame() closed
+    const GpuFrameCounters& lastFrame() const
+    {
+        return finished;
+    }
+
+    // memory held by the live objects of one type, as recorded with setBytes()
+    size_t bytes(GpuResourceType type) const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < slots.size(); i++)
+            if (slots[i].name != 0 && slots[i].type == type)
+                total += slots[i].bytes;
+        return total;
+    }
+
+    // memory held per object type and per pool
+    void report() const
+    {
+        static const char* typeNames[GPU_RESOURCE_TYPE_COUNT] = { "buffers", "vertex arrays", "textures", "framebuffers", "renderbuffers" };
+        size_t count[GPU_RESOURCE_TYPE_COUNT] = { 0 }, bytes[GPU_RESOURCE_TYPE_COUNT] = { 0 };
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].name == 0)
+                continue;
+            count[slots[i].type]++;
+            bytes[slots[i].type] += slots[i].bytes;
+        }
+        std::cout << "GPU resources:" << std::endl << std::fixed << std::setprecision(2);
+        for (int t = 0; t < GPU_RESOURCE_TYPE_COUNT; t++)
+            std::cout << "  " << std::left << std::setw(16) << typeNames[t] << std::right << std::setw(5) << count[t]
+                << std::setw(10) << bytes[t] / (1024.0 * 1024.0) << " MB" << std::endl;
+        for (size_t i = 0; i < pools.size(); i++)
+        {
+            size_t size = 0, used = 0;
+            for (size_t j = 0; j < pools[i].pages.size(); j++)
+            {
+                size += pools[i].pages[j].space.Size;
+                used += pools[i].pages[j].space.Used;
+            }
+            std::cout << "  pool " << pools[i].label << ": " << pools[i].pages.size() << " buffers, "
+                << used / (1024.0 * 1024.0) << " of " << size / (1024.0 * 1024.0) << " MB in use" << std::endl;
+        }
+        std::cout << "  waiting for the GPU: " << retired.size() << " deletions" << std::endl;
+        std::cout << std::defaultfloat << std::setprecision(6);
+    }
+
+    // at exit, with the context still current
+    void release()
+    {
+        glFinish();
+        while (fenceCount > 0)
+            popFence();
+        deleteRetired(frame);
+        for (size_t i = 0; i < pools.size(); i++)
+        {
+            for (size_t j = 0; j < pools[i].pages.size(); j++)
+                destroy(pools[i].pages[j].buffer);
+            pools[i].pages.clear();
+        }
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].name == 0)
+                continue;
+            std::cout << "ERROR::GPU_RESOURCES::LEAKED: " << slots[i].label << std::endl;
+            GpuHandle handle;
+            handle.index = (unsigned int)i;
+            handle.generation = slots[i].generation;
+            destroy(handle);
+        }
+        deleteRetired(frame);
+    }
+
+private:
+    struct Slot
+    {
+        GLuint name;
+        unsigned int generation;
+        GpuResourceType type;
+        size_t bytes;
+        const char* label;
+    };
+    struct Page
+    {
+        GpuHandle buffer;
+        OffsetAllocator space;
+    };
+    struct Pool
+    {
+        const char* label;
+        size_t alignment;
+        std::vector<Page> pages;
+    };
+    struct Retired
+    {
+        GpuResourceType type;       // GPU_RESOURCE_TYPE_COUNT for a pool range
+        GLuint name;
+        GpuRange range;
+        int64_t frame;
+    };
+    struct Fence
+    {
+        GLsync sync;
+        int64_t frame;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<unsigned int> freeSlots;
+    std::vector<Pool> pools;
+    std::vector<Retired> retired;
+    Fence fences[GPU_MAX_FENCES];
+    int64_t frame;
+    int64_t completedFrame;         // newest frame whose fence has signaled
+    int fenceFirst;
+    int fenceCount;
+    GpuFrameCounters counters;      // of the frame being drawn
+    GpuFrameCounters finished;
+
+    bool live(const GpuHandle& handle) const
+    {
+        return handle.generation != 0 && handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+    void popFence()
+    {
+        completedFrame = fences[fenceFirst].frame;
+        glDeleteSync(fences[fenceFirst].sync);
+        fenceFirst = (fenceFirst + 1) % GPU_MAX_FENCES;
+        fenceCount--;
+    }
+
+    // deletes everything retired up to and including frame last
+    void deleteRetired(int64_t last)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            const Retired& r = retired[i];
+            if (r.frame > last)
+            {
+                retired[kept++] = r;
+                continue;
+            }
+            switch (r.type)
+            {
+            case GPU_BUFFER: glDeleteBuffers(1, &r.name); break;
+            case GPU_VERTEX_ARRAY: glDeleteVertexArrays(1, &r.name); break;
+            case GPU_TEXTURE: glDeleteTextures(1, &r.name); break;
+            case GPU_FRAMEBUFFER: glDeleteFramebuffers(1, &r.name); break;
+            case GPU_RENDERBUFFER: glDeleteRenderbuffers(1, &r.name); break;
+            default:
+                if (r.range.page < (int)pools[r.range.pool].pages.size())
+                    pools[r.range.pool].pages[r.range.page].space.free(r.range.offset, r.range.size);
+                break;
+            }
+        }
+        retired.resize(kept);
+    }
+};
+
+// the resource manager of the GL context
+inline GpuResources& gpuResources()
+{
+    static GpuResources resources;
+    return resources;
+}
+
+#endif
@@ -0,0 +1,247 @@
+//
+//  input.h
+//  3D Object Drawing
+//
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+// Default input values
+const double SIM_STEP = 1.0 / 120.0;         // fixed simulation step in seconds
+const int SIM_MAX_STEPS = 8;                 // steps per frame before the clock is let go of
+const size_t INPUT_QUEUE_SIZE = 1024;        // events between two steps; more are dropped
+
+
+// Single-producer single-consumer ring buffer. The producer only writes tail, the consumer
+// only writes head, so neither side takes a lock. One slot stays empty to tell full from empty.
+template <class T, size_t Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % Capacity;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // oldest item, NULL when empty; stays valid until pop()
+    const T* front() const
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return NULL;
+        return &items[h];
+    }
+
+    void pop()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        head.store((h + 1) % Capacity, std::memory_order_release);
+    }
+
+private:
+    T items[Capacity];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+enum InputEventType
+{
+    INPUT_KEY,
+    INPUT_CURSOR,
+    INPUT_SCROLL,
+    INPUT_BUTTON
+};
+
+// One GLFW event, stamped with simulation time (seconds since the input system started)
+struct InputEvent
+{
+    double time;
+    int32_t type;
+    int32_t key;        // INPUT_KEY: GLFW key, INPUT_BUTTON: GLFW mouse button
+    int32_t action;     // INPUT_KEY, INPUT_BUTTON: GLFW_PRESS / GLFW_RELEASE / GLFW_REPEAT
+    float x, y;         // INPUT_CURSOR: position, INPUT_SCROLL: offset
+};
+
+// GLFW callbacks push timestamped events; the simulation consumes them one fixed step at
+// a time, so what the camera does no longer depends on the frame rate. Held keys are tracked
+// from the press/release events instead of polling glfwGetKey.
+// Every consumed event can be recorded to a file and played back: in replay the file's events
+// are fed to the same steps and live events are ignored, so a replay walks the exact same
+// camera path (ESC still quits).
+class InputSystem
+{
+public:
+    std::atomic<int> Dropped;       // events lost because the queue was full
+
+    InputSystem() : Dropped(0), epoch(0.0), replaying(false), replayNext(0), oldest(-1.0)
+    {
+        memset(keys, 0, sizeof(keys));
+    }
+
+    ~InputSystem()
+    {
+        if (recording.is_open())
+            recording.close();
+    }
+
+    void start()
+    {
+        epoch.store(glfwGetTime());
+    }
+
+    // seconds of simulation time so far; the clock stops while skip() drops time
+    double now() const
+    {
+        return glfwGetTime() - epoch.load();
+    }
+
+    // lets go of the given amount of time when the simulation cannot keep up
+    void skip(double seconds)
+    {
+        epoch.store(epoch.load() + seconds);
+    }
+
+    // from the GLFW callbacks
+    void key(int key, int action)
+    {
+        InputEvent event = { now(), INPUT_KEY, key, action, 0.0f, 0.0f };
+        push(event);
+    }
+
+    void cursor(double x, double y)
+    {
+        InputEvent event = { now(), INPUT_CURSOR, 0, 0, (float)x, (float)y };
+        push(event);
+    }
+
+    void scroll(double xoffset, double yoffset)
+    {
+        InputEvent event = { now(), INPUT_SCROLL, 0, 0, (float)xoffset, (float)yoffset };
+        push(event);
+    }
+
+    void button(int button, int action)
+    {
+        InputEvent event = { now(), INPUT_BUTTON, button, action, 0.0f, 0.0f };
+        push(event);
+    }
+
+    bool record(const std::string& path)
+    {
+        recording.open(path.c_str(), std::ios::binary);
+        if (!recording)
+        {
+            std::cout << "ERROR::INPUT::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        double step = SIM_STEP;
+        recording.write("INPR", 4);
+        recording.write((const char*)&step, sizeof(step));
+        return true;
+    }
+
+    bool replay(const std::string& path)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        char magic[4];
+        double step = 0.0;
+        if (!file.read(magic, 4) || memcmp(magic, "INPR", 4) != 0 || !file.read((char*)&step, sizeof(step)))
+        {
+            std::cout << "ERROR::INPUT::NOT_A_RECORDING: " << path << std::endl;
+            return false;
+        }
+        if (step != SIM_STEP)
+            std::cout << "ERROR::INPUT::STEP_MISMATCH: " << path << " was recorded at " << 1.0 / step << " Hz" << std::endl;
+        InputEvent event;
+        replayEvents.clear();
+        while (file.read((char*)&event, sizeof(event)))
+            replayEvents.push_back(event);
+        replayNext = 0;
+        replaying = true;
+        return true;
+    }
+
+    bool replayFinished() const
+    {
+        return replaying && replayNext >= replayEvents.size();
+    }
+
+    // glfwGetTime() of the oldest event handed out since the last call, -1 when there was none;
+    // for measuring how long input takes to reach the screen
+    double takeOldest()
+    {
+        double time = oldest < 0.0 ? -1.0 : oldest + epoch.load();
+        oldest = -1.0;
+        return time;
+    }
+
+    bool down(int key) const
+    {
+        return key >= 0 && key <= GLFW_KEY_LAST && keys[key];
+    }
+
+    // hands every event up to stepEnd to onEvent, oldest first
+    void step(double stepEnd, const std::function<void(const InputEvent&)>& onEvent)
+    {
+        const InputEvent* live;
+        while ((live = queue.front()) != NULL && live->time <= stepEnd)
+        {
+            InputEvent event = *live;
+            queue.pop();
+            if (!replaying)
+                consume(event, onEvent);
+            else if (event.type == INPUT_KEY && event.key == GLFW_KEY_ESCAPE)
+                onEvent(event);
+        }
+        while (replaying && replayNext < replayEvents.size() && replayEvents[replayNext].time <= stepEnd)
+            consume(replayEvents[replayNext++], onEvent);
+    }
+
+private:
+    SpscQueue<InputEvent, INPUT_QUEUE_SIZE> queue;
+    std::atomic<double> epoch;
+    bool keys[GLFW_KEY_LAST + 1];
+    std::ofstream recording;
+    bool replaying;
+    std::vector<InputEvent> replayEvents;
+    size_t replayNext;
+    double oldest;
+
+    void push(const InputEvent& event)
+    {
+        if (!queue.push(event))
+            Dropped++;
+    }
+
+    void consume(const InputEvent& event, const std::function<void(const InputEvent&)>& onEvent)
+    {
+        if (event.type == INPUT_KEY && event.key >= 0 && event.key <= GLFW_KEY_LAST)
+            keys[event.key] = event.action != GLFW_RELEASE;
+        if (recording.is_open())
+            recording.write((const char*)&event, sizeof(event));
+        if (oldest < 0.0)
+            oldest = event.time;
+        onEvent(event);
+    }
+};
+
+#endif
@@ -0,0 +1,533 @@
+//
+//  instance_batch.h
+//  3D Object Drawing
+//
+
+#ifndef INSTANCE_BATCH_H
+#define INSTANCE_BATCH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "texture_atlas.h"
+#include "frustum.h"
+#include "gpu_resources.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// Default batch values
+const size_t BATCH_UPLOAD_GAP = 8;      // unchanged commands between two culled ones that are rewritten instead of starting another upload
+
+// glMultiDrawElementsIndirect is GL 4.3, so it is fetched by hand: the 3.3 loader may not know it
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+
+inline MultiDrawElementsIndirectProc& multiDrawElementsIndirect()
+{
+    static MultiDrawElementsIndirectProc proc = NULL;
+    return proc;
+}
+
+// call once after gladLoadGLLoader; returns whether batches will be submitted with one indirect multi-draw
+inline bool loadIndirectDraw(GLADloadproc load)
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 3);
+    multiDrawElementsIndirect() = supported ? (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect") : NULL;
+    return multiDrawElementsIndirect() != NULL;
+}
+
+
+// Layout of one command in the GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;   // 1 = visible, 0 = culled
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct Mesh
+{
+    std::string name;
+    int indexCount;
+    int firstIndex;
+    int baseVertex;
+    float extent;           // half size of the mesh's bounding cube in model space
+};
+
+// World-space bounding box of one instance
+struct InstanceBounds
+{
+    glm::vec3 center;
+    glm::vec3 halfSize;
+};
+
+// Per-instance vertex data; attribute locations 2-10 in vertexShader.vs, shadowDepth.vs and pickId.vs
+struct InstanceData
+{
+    glm::mat4 model;        // locations 2-5
+    glm::vec4 surface;      // location 6: rgb = color, a = atlas layer (-1 = flat color)
+    glm::vec4 atlasRect;    // location 7: region of the layer the texture repeats in
+    float textureScale;     // location 8: texture repeats per world unit
+    GLuint pickId;          // location 9: placement the box belongs to, for picking (0 = none)
+    float opacity;          // location 10: 1 = opaque, less is drawn in the transparent pass
+};
+
+// which boxes of a batch a draw() submits: the main pass draws the opaque ones first and the
+// transparent ones on top (see transparency.h), shadows only the opaque ones
+enum DrawPass
+{
+    DRAW_ALL,
+    DRAW_OPAQUE,
+    DRAW_TRANSPARENT
+};
+
+// the shared buffers every batch's instances and draw commands are suballocated from
+inline int instancePool()
+{
+    static int pool = gpuResources().createPool("instances", sizeof(InstanceData));
+    return pool;
+}
+
+inline int commandPool()
+{
+    static int pool = gpuResources().createPool("draw commands", sizeof(DrawElementsIndirectCommand));
+    return pool;
+}
+
+// All meshes in one vertex and one index buffer, so draws of different meshes can share a VAO
+// and go out in the same multi-draw. Vertices are position + color, 6 floats each. Instances
+// come from the shared buffers of instancePool(); there is one VAO per buffer of the pool, so
+// every batch with its instances in the same buffer draws with the same VAO.
+class MeshBuffer
+{
+public:
+    unsigned int VBO;
+    unsigned int EBO;
+    std::vector<Mesh> Meshes;
+
+    MeshBuffer() : VBO(0), EBO(0) {}
+
+    // meshes have to be added before upload()
+    int add(const std::string& name, const float* meshVertices, int vertexCount, const unsigned int* meshIndices, int indexCount, float extent)
+    {
+        Mesh mesh;
+        mesh.name = name;
+        mesh.indexCount = indexCount;
+        mesh.firstIndex = (int)indices.size();
+        mesh.baseVertex = (int)(vertices.size() / 6);
+        mesh.extent = extent;
+        vertices.insert(vertices.end(), meshVertices, meshVertices + vertexCount * 6);
+        indices.insert(indices.end(), meshIndices, meshIndices + indexCount);
+        Meshes.push_back(mesh);
+        return (int)Meshes.size() - 1;
+    }
+
+    // index of the mesh called name, -1 if there is none
+    int find(const std::string& name) const
+    {
+        for (size_t i = 0; i < Meshes.size(); i++)
+            if (Meshes[i].name == name)
+                return (int)i;
+        return -1;
+    }
+
+    // world-space box around mesh drawn with the given model matrix
+    InstanceBounds bounds(int mesh, const glm::mat4& model) const
+    {
+        InstanceBounds result;
+        result.center = glm::vec3(model[3]);
+        result.halfSize = Meshes[mesh].extent * (glm::abs(glm::vec3(model[0])) + glm::abs(glm::vec3(model[1])) + glm::abs(glm::vec3(model[2])));
+        return result;
+    }
+
+    void upload()
+    {
+        vertexBuffer = gpuResources().create(GPU_BUFFER, "mesh vertices");
+        indexBuffer = gpuResources().create(GPU_BUFFER, "mesh indices");
+        gpuResources().setBytes(vertexBuffer, vertices.size() * sizeof(float));
+        gpuResources().setBytes(indexBuffer, indices.size() * sizeof(unsigned int));
+        VBO = gpuResources().get(vertexBuffer);
+        EBO = gpuResources().get(indexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        gpuResources().countUpload(vertices.size() * sizeof(float) + indices.size() * sizeof(unsigned int));
+    }
+
+    void release()
+    {
+        gpuResources().destroy(vertexBuffer);
+        gpuResources().destroy(indexBuffer);
+        for (size_t i = 0; i < pageArrays.size(); i++)
+            gpuResources().destroy(pageArrays[i].vertexArray);
+        pageArrays.clear();
+        VBO = EBO = 0;
+    }
+
+    // binds the VAO for instances in buffer `page` of instancePool(), made on first use
+    void bindVertexArray(int page) const
+    {
+        if (page >= (int)pageArrays.size())
+            pageArrays.resize(page + 1);
+        gpuResources().countStateChange();
+        PageArray& array = pageArrays[page];
+        if (gpuResources().get(array.vertexArray) == 0)
+        {
+            array.vertexArray = gpuResources().create(GPU_VERTEX_ARRAY, "mesh + instances");
+            glBindVertexArray(gpuResources().get(array.vertexArray));
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            // position and color attributes of the mesh
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)12);
+            glEnableVertexAttribArray(1);
+            array.pointed = false;
+            pointInstances(page, 0);
+            for (unsigned int location = 2; location <= 10; location++)
+            {
+                glEnableVertexAttribArray(location);
+                glVertexAttribDivisor(location, 1);
+            }
+            return;
+        }
+        glBindVertexArray(gpuResources().get(array.vertexArray));
+    }
+
+    // GL 3.3 has no base instance: the fallback path points the instance attributes of the bound
+    // page VAO at the first instance of each run it draws
+    void pointInstances(int page, GLuint firstInstance) const
+    {
+        PageArray& array = pageArrays[page];
+        if (array.pointed && array.firstInstance == firstInstance)
+            return;
+        size_t base = firstInstance * sizeof(InstanceData);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuResources().pageBuffer(instancePool(), page));
+        for (int i = 0; i < 4; i++)
+            glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, surface)));
+        glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, atlasRect)));
+        glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, textureScale)));
+        glVertexAttribIPointer(9, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, pickId)));
+        glVertexAttribPointer(10, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, opacity)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        array.firstInstance = firstInstance;
+        array.pointed = true;
+    }
+
+    // CPU copies of the buffers, for the software rasterizer: 6 floats per vertex, position first
+    const std::vector<float>& vertexData() const
+    {
+        return vertices;
+    }
+
+    const std::vector<unsigned int>& indexData() const
+    {
+        return indices;
+    }
+
+private:
+    struct PageArray
+    {
+        GpuHandle vertexArray;
+        GLuint firstInstance = 0;
+        bool pointed = false;
+    };
+
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    GpuHandle vertexBuffer;
+    GpuHandle indexBuffer;
+    mutable std::vector<PageArray> pageArrays;
+};
+
+
+// A list of boxes of any mesh in a MeshBuffer, submitted as one glMultiDrawElementsIndirect
+// with one command per box. The command list is only rebuilt when boxes are added;
+// cull() just sets each command's instance count to 0 or 1 and remembers which ones it
+// flipped, and upload() rewrites only those (runs of them, see BATCH_UPLOAD_GAP) instead of
+// the whole command buffer. Without GL 4.3 the commands are walked on the CPU and runs of
+// visible boxes go out as instanced draws.
+// Mesh, color, surface and opacity are sticky like the old "color" uniform: they apply to every
+// add() until changed. Filling a batch makes no GL calls (ranges of the shared instance and
+// command buffers are taken on the first upload), so batches can be built on worker threads.
+// Transparent boxes stay in the batch in any order; the uploaded command list has the opaque
+// ones first and the transparent ones after them, so either kind is still a single multi-draw.
+class InstanceBatch
+{
+public:
+    std::vector<InstanceData> Instances;
+    std::vector<InstanceBounds> Bounds;
+    std::vector<DrawElementsIndirectCommand> Commands;
+    GpuRange InstanceRange;         // of instancePool(); commands count instances from its buffer's start
+    GpuRange CommandRange;          // of commandPool()
+    int TransparentCount;           // boxes with opacity under 1
+    int VisibleTransparent;         // of those, left by the last cull
+
+    InstanceBatch(const MeshBuffer& meshBuffer)
+        : TransparentCount(0), VisibleTransparent(0), meshes(meshBuffer), mesh(0), color(1.0f), textureScale(1.0f), pickId(0), opacity(1.0f),
+        instancesDirty(true), commandsDirty(true)
+    {
+    }
+
+    void setMesh(int value)
+    {
+        mesh = value;
+    }
+
+    void setColor(glm::vec3 value)
+    {
+        color = value;
+    }
+
+    // texture for the following instances; a region with layer -1 means flat color
+    void setSurface(const AtlasRegion& value, float scale)
+    {
+        region = value;
+        textureScale = scale;
+    }
+
+    // 1 for opaque boxes, less for glass and the like
+    void setOpacity(float value)
+    {
+        opacity = value;
+    }
+
+    // placement the following instances are picked as (see picking.h)
+    void setPickId(unsigned int value)
+    {
+        pickId = value;
+    }
+
+    void add(const glm::mat4& model)
+    {
+        InstanceData instance;
+        instance.model = model;
+        instance.surface = glm::vec4(color, region.layer);
+        instance.atlasRect = region.rect;
+        instance.textureScale = textureScale;
+        instance.pickId = pickId;
+        instance.opacity = opacity;
+
+        const Mesh& m = meshes.Meshes[mesh];
+        InstanceBounds bounds = meshes.bounds(mesh, model);
+
+        DrawElementsIndirectCommand command;
+        command.count = m.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = m.firstIndex;
+        command.baseVertex = m.baseVertex;
+        command.baseInstance = (GLuint)Instances.size();
+
+        Instances.push_back(instance);
+        Bounds.push_back(bounds);
+        Commands.push_back(command);
+        if (opacity < 1.0f)
+            TransparentCount++;
+        instancesDirty = commandsDirty = true;
+    }
+
+    void clear()
+    {
+        Instances.clear();
+        Bounds.clear();
+        Commands.clear();
+        TransparentCount = VisibleTransparent = 0;
+        instancesDirty = commandsDirty = true;
+        changedSlots.clear();
+    }
+
+    // hides the boxes outside the frustum until the next cull; returns how many are left
+    // volume is anything with intersects(center, halfSize): a Frustum or a PortalVisibility
+    template <class Volume>
+    int cull(const Volume& volume)
+    {
+        int visible = 0;
+        VisibleTransparent = 0;
+        for (size_t i = 0; i < Commands.size(); i++)
+        {
+            GLuint count = volume.intersects(Bounds[i].center, Bounds[i].halfSize) ? 1 : 0;
+            if (Commands[i].instanceCount != count)
+            {
+                Commands[i].instanceCount = count;
+                if (!commandsDirty && multiDrawElementsIndirect() != NULL)
+                {
+                    // the uploaded list is intact but for this command; ordered mirrors it when some are transparent
+                    GLuint slot = TransparentCount == 0 ? (GLuint)i : slots[i];
+                    if (TransparentCount > 0)
+                        ordered[slot].instanceCount = count;
+                    changedSlots.push_back(slot);
+                }
+            }
+            visible += count;
+            if (TransparentCount > 0 && count != 0 && Instances[i].opacity < 1.0f)
+                VisibleTransparent++;
+        }
+        // most of the list changed (or cull ran many times without a draw): one write of it all
+        if (changedSlots.size() > Commands.size() / 2)
+        {
+            changedSlots.clear();
+            commandsDirty = true;
+        }
+        return visible;
+    }
+
+    // GPU bytes of the instance and command buffers once uploaded
+    size_t bytes() const
+    {
+        return Instances.size() * sizeof(InstanceData) + Commands.size() * sizeof(DrawElementsIndirectCommand);
+    }
+
+    // copies instances and commands to the GPU if they changed since the last upload
+    void upload()
+    {
+        if (instancesDirty)
+        {
+            size_t size = Instances.size() * sizeof(InstanceData);
+            if (size > InstanceRange.size)
+            {
+                gpuResources().free(InstanceRange);
+                InstanceRange = gpuResources().allocate(instancePool(), size);
+                commandsDirty = true;
+            }
+            gpuResources().write(InstanceRange, Instances.data(), size);
+            instancesDirty = false;
+        }
+        if (commandsDirty && multiDrawElementsIndirect() != NULL)
+        {
+            // base instances are where the instances ended up in the shared buffer
+            GLuint first = (GLuint)(InstanceRange.offset / sizeof(InstanceData));
+            for (size_t i = 0; i < Commands.size(); i++)
+                Commands[i].baseInstance = first + (GLuint)i;
+            size_t size = Commands.size() * sizeof(DrawElementsIndirectCommand);
+            if (size > CommandRange.size)
+            {
+                gpuResources().free(CommandRange);
+                CommandRange = gpuResources().allocate(commandPool(), size);
+            }
+            if (TransparentCount == 0)
+                gpuResources().write(CommandRange, Commands.data(), size);
+            else
+            {
+                // opaque first, transparent last; the base instances keep each command on its instance
+                ordered.clear();
+                slots.resize(Commands.size());
+                for (int transparent = 0; transparent < 2; transparent++)
+                    for (size_t i = 0; i < Commands.size(); i++)
+                        if ((Instances[i].opacity < 1.0f) == (transparent == 1))
+                        {
+                            slots[i] = (GLuint)ordered.size();
+                            ordered.push_back(Commands[i]);
+                        }
+                gpuResources().write(CommandRange, ordered.data(), size);
+            }
+            commandsDirty = false;
+            changedSlots.clear();
+        }
+        if (!changedSlots.empty())
+        {
+            // the commands cull() flipped since the last upload, in runs
+            const DrawElementsIndirectCommand* uploaded = TransparentCount == 0 ? Commands.data() : ordered.data();
+            std::sort(changedSlots.begin(), changedSlots.end());
+            size_t run = 0;
+            while (run < changedSlots.size())
+            {
+                size_t end = run + 1;
+                while (end < changedSlots.size() && changedSlots[end] <= changedSlots[end - 1] + BATCH_UPLOAD_GAP)
+                    end++;
+                GLuint first = changedSlots[run], last = changedSlots[end - 1];
+                gpuResources().write(CommandRange, uploaded + first, (last - first + 1) * sizeof(DrawElementsIndirectCommand),
+                    first * sizeof(DrawElementsIndirectCommand));
+                run = end;
+            }
+            changedSlots.clear();
+        }
+    }
+
+    void draw(DrawPass pass = DRAW_ALL)
+    {
+        size_t opaqueCount = Commands.size() - TransparentCount;
+        size_t firstCommand = pass == DRAW_TRANSPARENT ? opaqueCount : 0;
+        size_t commandCount = pass == DRAW_ALL ? Commands.size() : (pass == DRAW_OPAQUE ? opaqueCount : TransparentCount);
+        if (commandCount == 0)
+            return;
+        upload();
+        meshes.bindVertexArray(InstanceRange.page);
+        if (multiDrawElementsIndirect() != NULL)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuResources().buffer(CommandRange));
+            multiDrawElementsIndirect()(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(CommandRange.offset + firstCommand * sizeof(DrawElementsIndirectCommand)),
+                (GLsizei)commandCount, 0);
+            gpuResources().countDraw();
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+
+        // GL 3.3 has no base instance: point the instance attributes at each run of consecutive
+        // visible boxes of the same mesh and draw the run instanced
+        GLuint firstInstance = (GLuint)(InstanceRange.offset / sizeof(InstanceData));
+        for (size_t i = 0; i < Commands.size();)
+        {
+            const DrawElementsIndirectCommand& first = Commands[i];
+            size_t end = i + 1;
+            if (!drawn(i, pass))
+            {
+                i = end;
+                continue;
+            }
+            while (end < Commands.size() && drawn(end, pass) && Commands[end].firstIndex == first.firstIndex && Commands[end].baseVertex == first.baseVertex)
+                end++;
+            meshes.pointInstances(InstanceRange.page, firstInstance + (GLuint)i);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, first.count, GL_UNSIGNED_INT, (void*)(first.firstIndex * sizeof(unsigned int)),
+                (GLsizei)(end - i), first.baseVertex);
+            gpuResources().countDraw();
+            i = end;
+        }
+    }
+
+    // gives the ranges back; they are reused once the GPU is past the frames that drew them
+    void release()
+    {
+        gpuResources().free(InstanceRange);
+        gpuResources().free(CommandRange);
+        instancesDirty = commandsDirty = true;
+    }
+
+private:
+    const MeshBuffer& meshes;
+    int mesh;
+    glm::vec3 color;
+    AtlasRegion region;
+    float textureScale;
+    unsigned int pickId;
+    float opacity;
+    bool instancesDirty;
+    bool commandsDirty;
+    std::vector<DrawElementsIndirectCommand> ordered;   // upload order of the commands when some are transparent
+    std::vector<GLuint> slots;                          // where each command is in ordered
+    std::vector<GLuint> changedSlots;                   // uploaded commands cull() changed since the last upload
+
+    // whether the GL 3.3 path draws box i in this pass
+    bool drawn(size_t i, DrawPass pass) const
+    {
+        if (Commands[i].instanceCount == 0)
+            return false;
+        return pass == DRAW_ALL || (Instances[i].opacity < 1.0f) == (pass == DRAW_TRANSPARENT);
+    }
+};
+
+#endif
@@ -15,28 +15,116 @@
 #include "shader.h"
 #include "camera.h"
 #include "basic_camera.h"
+#include "shadow_map.h"
+#include "texture_streamer.h"
+#include "texture_atlas.h"
+#include "instance_batch.h"
+#include "scene.h"
+#include "world_partition.h"
+#include "portals.h"
+#include "input.h"
+#include "pipeline.h"
+#include "reverse_z.h"
+#include "adaptive_resolution.h"
+#include "software_rasterizer.h"
+#include "golden.h"
+#include "frame_arena.h"
+#include "gpu_resources.h"
+#include "picking.h"
+#include "animation.h"
+#include "settings.h"
+#include "frame_pacing.h"
+#include "post_process.h"
+#include "transparency.h"
+#include "telemetry.h"
 
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 
 using namespace std;
 
+// every C++ heap allocation of the program goes through here, so --count-allocations can see them
+// and the telemetry can count the live bytes per subsystem (heapBytes() in frame_arena.h); the
+// header keeps the blocks as aligned as malloc's
+struct HeapHeader
+{
+    size_t bytes;
+    HeapTag tag;
+};
+const size_t HEAP_HEADER_SIZE = 16;
+static_assert(sizeof(HeapHeader) <= HEAP_HEADER_SIZE, "heap header larger than its slot");
+
+void* operator new(size_t size)
+{
+    heapAllocations()++;
+    HeapHeader* header = (HeapHeader*)malloc(HEAP_HEADER_SIZE + size);
+    if (header == NULL)
+        throw std::bad_alloc();
+    header->bytes = size;
+    header->tag = heapTag();
+    heapBytes()[header->tag].fetch_add((int64_t)size, std::memory_order_relaxed);
+    return (unsigned char*)header + HEAP_HEADER_SIZE;
+}
+// replaced too, so no block can come from a library's own malloc without the header
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return operator new(size);
+    }
+    catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+void operator delete(void* memory) noexcept
+{
+    if (memory == NULL)
+        return;
+    HeapHeader* header = (HeapHeader*)((unsigned char*)memory - HEAP_HEADER_SIZE);
+    heapBytes()[header->tag].fetch_sub((int64_t)header->bytes, std::memory_order_relaxed);
+    free(header);
+}
+// the sized form must not bypass the header on toolchains that do not forward it on their own
+void operator delete(void* memory, size_t) noexcept
+{
+    operator delete(memory);
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void processInput(GLFWwindow* window);
-void drawbed(unsigned int VAO1, Shader ourShader, glm::mat4 isha);
-void wall(unsigned int VAO, Shader ourShader, glm::mat4 isha);
-void wall2(unsigned int VAO, Shader ourShader, glm::mat4 isha);
-void floor(unsigned int VAO, Shader ourShader, glm::mat4 isha);
-// settings
-const unsigned int SCR_WIDTH = 800;
-const unsigned int SCR_HEIGHT = 600;
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void handleInput(const InputEvent& event);
+void simulate(float step);
+int benchmarkCamera();
+int benchmarkAnimation();
+int renderSoftware(const std::string& path, int threads);
+void addMeshes(MeshBuffer& meshBuffer);
+void addPlacement(InstanceBatch& batch, const ScenePrefab& prefab, const glm::mat4& model);
+glm::mat4 animationTransform(const std::string& binding);
+void renderShadows(ShadowMap& shadow, Shader depthShader, WorldPartition& world, InstanceBatch& animated);
+void setLighting(Shader ourShader, const CascadedShadowMap& sunShadow, const ShadowMap& spotShadow);
+void requestSurfaceMips(const WorldPartition& world, glm::vec3 cameraPosition, float zoom, int viewportHeight);
+// settings: defaults, settings file and command line (see settings.h)
+Settings settings;
+
+// lighting: sun coming in through the window and a spot light hanging from the ceiling above the fan
+const glm::vec3 SUN_DIRECTION = glm::vec3(0.3f, -1.0f, -0.6f);
+const glm::vec3 SUN_COLOR = glm::vec3(0.55f, 0.52f, 0.45f);
+const glm::vec3 SPOT_POSITION = glm::vec3(0.4f, 1.5f, 0.2f);
+const glm::vec3 SPOT_DIRECTION = glm::vec3(0.0f, -1.0f, 0.0f);
+const glm::vec3 SPOT_COLOR = glm::vec3(0.9f, 0.85f, 0.7f);
+const float SPOT_INNER_ANGLE = 35.0f;
+const float SPOT_OUTER_ANGLE = 50.0f;
+const float AMBIENT = 0.35f;
 
 // modelling transform
 float rotateAngle_X = 0.0;
 float rotateAngle_Y = 0.0;
 float rotateAngle_Z = 0.0;
-float Fan_rotateAngle_Y = 0.0;
 float rotateAxis_X = 0.0;
 float rotateAxis_Y = 0.0;
 float rotateAxis_Z = 1.0;
@@ -47,18 +135,93 @@ float scale_X = 1.0;
 float scale_Y = 1.0;
 float scale_Z = 1.0;
 bool fan_turn = false;
-bool rotate_around = false;
+bool rotate_around = false;     // F: orbit the camera around ORBIT_TARGET
+const glm::vec3 ORBIT_TARGET = glm::vec3(0.0f, 0.0f, 0.0f);
+const float ORBIT_SPEED = 0.5f;  // radians per second
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
-float lastX = SCR_WIDTH / 2.0f;
-float lastY = SCR_HEIGHT / 2.0f;
+float lastX = SETTINGS_WIDTH / 2.0f;
+float lastY = SETTINGS_HEIGHT / 2.0f;
 bool firstMouse = true;
 
 float eyeX = 0.0, eyeY = 1.0, eyeZ = 3.0;
 float lookAtX = 0.0, lookAtY = 0.0, lookAtZ = 0.0;
 glm::vec3 V = glm::vec3(0.0f, 1.0f, 0.0f);
 BasicCamera basic_camera(eyeX, eyeY, eyeZ, lookAtX, lookAtY, lookAtZ, V);
+// the camera the frame is drawn from; point it at basic_camera for the fixed look-at view
+CameraBase* activeCamera = &camera;
+
+// textures: one streamed array packed by --pack-textures, surfaces are regions of it
+TextureStreamer* textures = NULL;
+TextureAtlas atlas;
+int atlasTexture = -1;
+AtlasRegion floorSurface;
+AtlasRegion wallSurface;
+AtlasRegion woodSurface;
+
+// the shared MeshBuffer; scene boxes name their mesh
+MeshBuffer* meshes = NULL;
+
+// input, consumed by the fixed simulation step
+InputSystem input;
+std::atomic<bool> quitRequested(false);
+std::atomic<bool> gpuReportRequested(false);    // M: print the GPU memory report
+
+// keyframe animation of the nodes scene placements are bound to; the clocks move in the
+// simulation step and the simulation thread poses the hierarchy once per frame
+Animator animator;
+
+// picking: a left click picks the placement under the cursor (see picking.h); the GL thread
+// hands each result back to the simulation thread, which owns the selection
+bool pickRequested = false;
+std::atomic<int> pickedId(-1);                  // newest pick result, -1 when there is none
+const int PICK_BENCH_WARMUP_FRAMES = 300;       // --bench-picking: frames before measuring
+const int PICK_BENCH_FRAMES = 300;              // frames measured without and then with picking
+
+// --reverse-z: main pass into a float depth target with reversed depth (needs glClipControl)
+bool reverseZ = false;
+
+// framebuffer width over height, kept by framebuffer_size_callback for the simulation thread
+std::atomic<float> windowAspect((float)SETTINGS_WIDTH / (float)SETTINGS_HEIGHT);
+
+// --golden / --golden-update: draw the poses of GOLDEN_POSES_PATH and compare or store the frames
+GoldenRun golden;
+bool goldenRunning = false;
+
+// --flythrough <poses>: the camera flies the path of a poses file once, then the program exits
+Flythrough flythrough;
+bool flying = false;
+
+// --count-allocations: heap allocations of steady-state frames, which should be none
+const int ALLOCATION_WARMUP_FRAMES = 300;       // frames for the scene, cells and textures to load first
+const int ALLOCATION_COUNTED_FRAMES = 300;
+
+// Everything the GL thread needs to draw one frame. The simulation thread fills one of these
+// for frame N+1 while the GL thread draws frame N from the other (see FramePipeline).
+struct FrameState
+{
+    explicit FrameState(const MeshBuffer& meshes) : goldenPose(-1), goldenFrame(0), pick(false), selectedId(0), inputTime(-1.0), animated(meshes) {}
+
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    Frustum frustum;                            // planes of viewProjection
+    glm::vec3 cameraPosition;
+    float zoom;
+    float aspect;                               // of projection
+    int goldenPose;                             // pose of the golden run shown, -1 outside of one
+    int goldenFrame;                            // frame of that pose
+    bool pick;                                  // run the ID pass at pickCursor this frame
+    glm::vec2 pickCursor;                       // window coordinates, origin top left
+    int selectedId;                             // placement drawn highlighted, 0 for none
+    double inputTime;                           // glfwGetTime() of the oldest input event taken in, -1 for none
+    InstanceBatch animated;                     // animated placements at this frame's pose
+    PortalVisibility visibility;                // cells seen from the camera
+    std::vector<ScenePlacement> newStatic;      // static placements loaded since the last frame
+    std::vector<ScenePrefab> newStaticPrefabs;  // their prefabs, same order
+};
+void simulationLoop(FramePipeline<FrameState>* pipeline);
 
 // timing
 float deltaTime = 0.0f;    // time between current frame and last frame
@@ -75,22 +238,119 @@ glm::mat4 transform(float tx, float ty, float tz, float sx, float sy, float sz)
     model = translateMatrix * rotateXMatrix * rotateYMatrix * rotateZMatrix * scaleMatrix;
     return model;
 }
-int main()
+int main(int argc, char** argv)
 {
+    // build step: pack textures into the layers of one KTX2 array and exit
+    // usage: 3D --pack-textures <output prefix> <texture.dds|ktx2>...
+    if (argc > 3 && std::string(argv[1]) == "--pack-textures")
+        return packTextureAtlas(std::vector<std::string>(argv + 3, argv + argc), ATLAS_LAYER_SIZE, argv[2]) ? 0 : -1;
+    // build step: text scene to the binary chunked form
+    // usage: 3D --convert-scene <in.scene> <out.sceneb>
+    if (argc == 4 && std::string(argv[1]) == "--convert-scene")
+        return SceneFile::convert(argv[2], argv[3]) ? 0 : -1;
+    // window, camera, scene, workers and benchmark length: 3D [--config <file>] [--<setting> <value>]...
+    if (!settings.parse(argc, argv))
+        return -1;
+    camera.MovementSpeed = settings.Speed;
+    camera.MouseSensitivity = settings.Sensitivity;
+    camera.Zoom = settings.Fov;
+    lastX = settings.Width / 2.0f;
+    lastY = settings.Height / 2.0f;
+    // camera update throughput, no window needed
+    // usage: 3D --bench-camera
+    if (argc == 2 && std::string(argv[1]) == "--bench-camera")
+        return benchmarkCamera();
+    // animation evaluation throughput for many props at once
+    // usage: 3D --bench-animation
+    if (argc == 2 && std::string(argv[1]) == "--bench-animation")
+        return benchmarkAnimation();
+    // CPU rendering without a window or GPU: 3D --software <image.ppm> [--threads <n>] draws the
+    // scene from the start camera, writes the image and exits
+    std::string softwarePath;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--software")
+            softwarePath = argv[++i];
+    if (!softwarePath.empty())
+        return renderSoftware(softwarePath, settings.Threads);
+    // input capture: 3D --record <file> saves every input event, 3D --replay <file> plays one
+    // back instead of the live input, prints the frame times and exits
+    std::string recordPath, replayPath;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--record")
+            recordPath = argv[++i];
+        else if (std::string(argv[i]) == "--replay")
+            replayPath = argv[++i];
+    }
+    // 3D --reverse-z draws the main pass with reverse-Z into a 32-bit float depth buffer
+    reverseZ = settings.ReverseZ;
+    // the main pass is drawn at a resolution that follows the GPU frame time;
+    // 3D --fixed-resolution always draws it at the window size
+    ResolutionController resolution;
+    resolution.Enabled = !settings.FixedResolution;
+    // golden images: 3D --golden <dir> draws every pose of GOLDEN_POSES_PATH in a hidden window,
+    // compares the frames and frame times with the ones stored in dir and exits with 1 on any
+    // regression; 3D --golden-update <dir> stores them instead
+    for (int i = 1; i + 1 < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--golden" || flag == "--golden-update") {
+            if (!golden.load(GOLDEN_POSES_PATH, argv[++i], flag == "--golden-update"))
+                return -1;
+            goldenRunning = true;
+            resolution.Enabled = false;
+            settings.Headless = true;
+        }
+    }
+    // 3D --flythrough <poses> flies the camera along the poses of a file once the scene has loaded,
+    // prints the frame time and exits; a repeatable run with the camera moving
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--flythrough") {
+            if (!flythrough.load(argv[++i]))
+                return -1;
+            flying = true;
+        }
+    // 3D --count-allocations draws ALLOCATION_WARMUP_FRAMES frames in a hidden window, then counts
+    // the heap allocations of the next ALLOCATION_COUNTED_FRAMES and exits with 1 if there were any
+    bool countAllocations = false;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--count-allocations") {
+            countAllocations = true;
+            settings.Headless = true;
+        }
+    // 3D --bench-picking draws PICK_BENCH_FRAMES frames without picking and as many with a pick
+    // at the window center every frame, after a warm-up, and prints the frame times of both
+    bool benchPicking = false;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--bench-picking") {
+            benchPicking = true;
+            resolution.Enabled = false;
+            settings.Headless = true;
+            // frame times of the benchmark without the wait for vertical sync
+            settings.Vsync = "off";
+        }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // 4.3 submits the scene with glMultiDrawElementsIndirect; 3.3 is the fallback
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+    if (settings.Headless)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     // glfw window creation
     // --------------------
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "CSE 4208: Computer Graphics Laboratory", NULL, NULL);
+    GLFWwindow* window = glfwCreateWindow(settings.Width, settings.Height, "CSE 4208: Computer Graphics Laboratory", NULL, NULL);
+    if (window == NULL)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(settings.Width, settings.Height, "CSE 4208: Computer Graphics Laboratory", NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -101,6 +361,9 @@ int main()
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    setVsync(settings.Vsync);
 
     // tell GLFW to capture our mouse
    // glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -112,6 +375,16 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (!loadIndirectDraw((GLADloadproc)glfwGetProcAddress))
+        std::cout << "glMultiDrawElementsIndirect not available, drawing with the GL 3.3 fallback" << std::endl;
+    if (reverseZ && !loadClipControl((GLADloadproc)glfwGetProcAddress)) {
+        std::cout << "glClipControl not available, drawing without reverse-Z" << std::endl;
+        reverseZ = false;
+    }
+    // viewport and aspect of the window as created; the callback sets glViewport, so not before glad
+    int initialWidth, initialHeight;
+    glfwGetFramebufferSize(window, &initialWidth, &initialHeight);
+    framebuffer_size_callback(window, initialWidth, initialHeight);
 
     // configure global opengl state
     // -----------------------------
@@ -119,35 +392,47 @@ int main()
 
     // build and compile our shader zprogram
     // ------------------------------------
-    Shader ourShader("vertexShader.vs", "fragmentShader.fs");
+    Shader ourShader(settings.shader("vertexShader.vs").c_str(), settings.shader("fragmentShader.fs").c_str());
+    Shader depthShader(settings.shader("shadowDepth.vs").c_str(), settings.shader("shadowDepth.fs").c_str());
+    Shader pickShader(settings.shader("pickId.vs").c_str(), settings.shader("pickId.fs").c_str());
+    // glass and other boxes with opacity: the main pass shader writing into the OIT targets
+    Shader transparentShader(settings.shader("vertexShader.vs").c_str(), settings.shader("fragmentShader.fs").c_str(), "#define TRANSPARENT\n");
+    TransparencyPass transparency(settings.shader("composite.vs"), settings.shader("transparencyResolve.fs"));
+    GpuPicker picker;
+    // tonemapping, antialiasing and bloom in one composite pass from the main pass to the window
+    PostProcess post(settings.shader("composite.vs"), settings.shader("composite.fs"));
+    post.Features = settings.postFeatures();
+    post.Exposure = settings.Exposure;
+    post.BloomStrength = settings.Bloom;
+
+    // shadow maps: cascades for the sun, a single perspective layer for the ceiling spot
+    // ------------------------------------------------------------------------------------
+    CascadedShadowMap sunShadow(SHADOW_MAP_SIZE);
+    ShadowMap spotShadow(SPOT_SHADOW_MAP_SIZE, 1);
+    spotShadow.LightSpace[0] = glm::perspective(glm::radians(2.0f * SPOT_OUTER_ANGLE), 1.0f, 0.05f, 10.0f) *
+        glm::lookAt(SPOT_POSITION, SPOT_POSITION + SPOT_DIRECTION, glm::vec3(0.0f, 0.0f, -1.0f));
+
+    // main pass target at the render resolution, in HDR for the composite pass, scaled up to the window; sized on first use
+    SceneTarget sceneTarget(reverseZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, settings.Samples, post.colorFormat());
+    GpuFrameTimer gpuTimer;
+
+    // textures: floor, walls and furniture share one array so the whole room stays a few instanced draws;
+    // only the coarse tail is loaded up front, finer mips stream in as the camera gets close
+    // ---------------------------------------------------------------------------------------------------
+    TextureStreamer textureStreamer(TEXTURE_BUDGET, settings.Threads);
+    textures = &textureStreamer;
+    if (atlas.load(ATLAS_PATH + ".atlas"))
+        atlasTexture = textureStreamer.load(ATLAS_PATH + ".ktx2");
+    floorSurface = atlas.find("floor");
+    wallSurface = atlas.find("wall");
+    woodSurface = atlas.find("wood");
+    ourShader.use();
+    ourShader.setInt("diffuseAtlas", 0);
+    transparentShader.use();
+    transparentShader.setInt("diffuseAtlas", 0);
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
-    float cube_vertices[] = {
-       -0.25f, -0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
-        0.25f, -0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
-        0.25f, 0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
-        -0.25f, 0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
-        -0.25f, -0.25f, 0.25f, 0.3f, 0.8f, 0.5f,
-        0.25f, -0.25f, 0.25f, 0.5f, 0.4f, 0.3f,
-        0.25f, 0.25f, 0.25f, 0.2f, 0.7f, 0.3f,
-        -0.25f, 0.25f, 0.25f, 0.6f, 0.2f, 0.8f
-    };
-
-    float bed[] = {
-     -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 0.0f,
-      0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 0.0f,
-      0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
-      -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
-      -0.5f, 0.5f, 0.5f, 0.3f, 0.8f, 0.5f,
-      0.5f, 0.5f, 0.5f, 0.5f, 0.4f, 0.3f,
-      0.5f, 0.5f, -0.5f, 0.2f, 0.7f, 0.3f,
-      -0.5f, 0.5f, -0.5f, 0.6f, 0.2f, 0.8f
-    };
-    unsigned int bed_indices[] = {
-        0,1,2, 0,3,2, 0,1,5, 0,4,5, 0,3,7, 0,4,7, 2,1,5, 2,6,5, 3,2,7, 7,6,2, 4,5,6, 6,7,4,
-    };
-
     /*float cube_vertices[] = {
         0.0f, 0.0f, 0.0f,
         0.5f, 0.0f, 0.0f,
@@ -160,25 +445,6 @@ int main()
     };*/
     
     
-    unsigned int cube_indices[] = {
-         0, 3, 2,
-        2, 1, 0,
-
-        1, 2, 6,
-        6, 5, 1,
-
-        5, 6, 7,
-        7 ,4, 5,
-
-        4, 7, 3,
-        3, 0, 4,
-
-        6, 2, 3,
-        3, 7, 6,
-
-        1, 5, 4,
-        4, 0, 1
-    };
     /*unsigned int cube_indices[] = {
         0, 3, 2,
         2, 1, 0,
@@ -267,9 +533,11 @@ int main()
     };
 
     //axis line VBO,VAO
-    unsigned int axisVAO, axisVBO;
-    glGenVertexArrays(1, &axisVAO);
-    glGenBuffers(1, &axisVBO);
+    GpuHandle axisArray = gpuResources().create(GPU_VERTEX_ARRAY, "axis");
+    GpuHandle axisBuffer = gpuResources().create(GPU_BUFFER, "axis vertices");
+    gpuResources().setBytes(axisBuffer, sizeof(axisVertices));
+    unsigned int axisVAO = gpuResources().get(axisArray);
+    unsigned int axisVBO = gpuResources().get(axisBuffer);
 
     // Bind the axis VAO and VBO
     glBindVertexArray(axisVAO);
@@ -280,201 +548,152 @@ int main()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    unsigned int VBO, VAO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
-   
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    //color attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)12);
-    glEnableVertexAttribArray(1);
-
-
-    unsigned int VBO1, VAO1, EBO1;
-    glGenVertexArrays(1, &VAO1);
-    glGenBuffers(1, &VBO1);
-    glGenBuffers(1, &EBO1);
-    glBindVertexArray(VAO1);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO1);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(bed), bed, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO1);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(bed_indices), bed_indices, GL_STATIC_DRAW);
-    
-    //position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    //color attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)12);
-    glEnableVertexAttribArray(1);
-
+    // cube and bed share one vertex/index buffer so a whole batch is a single multi-draw
+    MeshBuffer meshBuffer;
+    addMeshes(meshBuffer);
+    meshBuffer.upload();
+    meshes = &meshBuffer;
+
+    // the layout comes from a scene file parsed in the background; static placements go into the
+    // world partition, which builds and uploads the cells around the camera, animated ones (the
+    // fan blades) are rebuilt every frame
+    WorldPartition world(meshBuffer, addPlacement);
+
+    // memory and GPU upload snapshots for sessions that run for days (see telemetry.h)
+    Telemetry telemetry;
+    telemetry.Interval = settings.TelemetryInterval;
+    if (!settings.Telemetry.empty() && !telemetry.open(settings.Telemetry))
+        return -1;
 
-    while (!glfwWindowShouldClose(window))
+    if (!recordPath.empty())
+        input.record(recordPath);
+    if (!replayPath.empty() && !input.replay(replayPath))
+        return -1;
+    input.start();
+    double frameTimeTotal = 0.0;
+    int frames = 0;
+    size_t allocationsBefore = 0;
+    double benchCpuMs[2] = { 0.0, 0.0 }, benchGpuMs[2] = { 0.0, 0.0 };
+    int benchGpuFrames[2] = { 0, 0 }, benchPicks = 0;
+
+    // the simulation thread steps input, camera and animation and builds frame N+1 while this
+    // thread submits frame N; it also owns the scene loader and the portal graph
+    FramePipeline<FrameState> pipeline(meshBuffer);
+    pipeline.Lockstep = settings.Latency == "low";
+    std::thread simulation(simulationLoop, &pipeline);
+
+    // frame rate cap and input-to-photon latency (see frame_pacing.h)
+    FrameLimiter limiter(settings.FpsLimit);
+    LatencyMeter latency;
+    if (!settings.LatencyLog.empty())
+        latency.log(settings.LatencyLog);
+    // what this thread allocates from here on is the renderer's
+    HeapScope renderHeap(HEAP_RENDER);
+
+    while (!glfwWindowShouldClose(window) && !quitRequested)
     {
         // per-frame time logic
         // --------------------
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;  processInput(window);
+        lastFrame = currentFrame;
+        if (frames > 0)
+            frameTimeTotal += deltaTime;
+        if (countAllocations && frames == ALLOCATION_WARMUP_FRAMES)
+            allocationsBefore = heapAllocations();
+        if (countAllocations && frames == ALLOCATION_WARMUP_FRAMES + ALLOCATION_COUNTED_FRAMES)
+            break;
+        if (settings.Frames > 0 && frames == settings.Frames)
+            break;
+        // --bench-picking: phase 0 draws without picking, phase 1 picks every frame
+        int benchPhase = benchPicking ? (frames - PICK_BENCH_WARMUP_FRAMES) / PICK_BENCH_FRAMES : -1;
+        if (frames < PICK_BENCH_WARMUP_FRAMES)
+            benchPhase = -1;
+        if (benchPhase >= 2)
+            break;
+        frames++;
+
+        if (!pipeline.acquire())
+            break;
+        FrameState& frame = pipeline.current();
+        double frameStart = glfwGetTime();
+        glm::mat4 projection = frame.projection;
+        glm::mat4 view = frame.view;
+        InstanceBatch& animated = frame.animated;
+
+        for (size_t i = 0; i < frame.newStatic.size(); i++)
+            world.add(frame.newStatic[i], frame.newStaticPrefabs[i]);
+        if (world.update(frame.cameraPosition)) {
+            sunShadow.invalidateStatic();
+            spotShadow.invalidateStatic();
+        }
+        // render resolution from the GPU time of frames a few behind this one
+        float gpuMs;
+        while (gpuTimer.poll(gpuMs)) {
+            resolution.update(gpuMs);
+            if (benchPhase >= 0) {
+                benchGpuMs[benchPhase] += gpuMs;
+                benchGpuFrames[benchPhase]++;
+            }
+        }
+        latency.poll();
+        // picks finished by the GPU since the last frame
+        unsigned int picked;
+        while (picker.poll(picked)) {
+            pickedId = (int)picked;
+            if (benchPhase == 1)
+                benchPicks++;
+        }
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        int renderWidth = resolution.scaled(fbWidth);
+        int renderHeight = resolution.scaled(fbHeight);
+
+        requestSurfaceMips(world, frame.cameraPosition, frame.zoom, renderHeight);
+        textureStreamer.update();
+
+        // shadow passes: static layers only when their light matrix changed, fan blades every frame
+        gpuTimer.begin();
+        sunShadow.update(view, glm::radians(frame.zoom), frame.aspect, settings.Near, SUN_DIRECTION);
+        renderShadows(sunShadow, depthShader, world, animated);
+        renderShadows(spotShadow, depthShader, world, animated);
+        sunShadow.end(fbWidth, fbHeight);
+
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (reverseZ)
+            beginReverseZ();
+        sceneTarget.begin(renderWidth, renderHeight);
         // activate shader
         ourShader.use();
-        // pass projection matrix to shader (note that in this case it could change every frame)
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        //glm::mat4 projection = glm::ortho(-2.0f, +2.0f, -1.5f, +1.5f, 0.1f, 100.0f);
         ourShader.setMat4("projection", projection);
-
-        // camera/view transformation
-        glm::mat4 view = camera.GetViewMatrix();
-        //glm::mat4 view = basic_camera.createViewMatrix();
         ourShader.setMat4("view", view);
+        setLighting(ourShader, sunShadow, spotShadow);
+        ourShader.setBool("texturesReady", textureStreamer.bind(atlasTexture, 0));
+        ourShader.setInt("selectedId", frame.selectedId);
+
+        world.cull(frame.visibility);
+        animated.cull(frame.visibility);
+        world.draw(DRAW_OPAQUE);
+        animated.draw(DRAW_OPAQUE);
+        // transparent boxes over the opaque ones, unsorted (see transparency.h)
+        if (world.visibleTransparent() + animated.VisibleTransparent > 0) {
+            transparency.begin(sceneTarget);
+            transparentShader.use();
+            transparentShader.setMat4("projection", projection);
+            transparentShader.setMat4("view", view);
+            setLighting(transparentShader, sunShadow, spotShadow);
+            transparentShader.setBool("texturesReady", textureStreamer.bind(atlasTexture, 0));
+            transparentShader.setInt("selectedId", frame.selectedId);
+            world.draw(DRAW_TRANSPARENT);
+            animated.draw(DRAW_TRANSPARENT);
+            transparency.end(sceneTarget);
+            ourShader.use();
+        }
+
         glm::mat4 identityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-        glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, Fan_rotateYMatrix, bed_rotateMatrix, scaleMatrix,
-            fan_scaleMatrix, bed_scaleMatrix, model, fan_model, bed_model, table_scaleMatrix;
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.0f, -0.5f, translate_Z));
-        drawbed(VAO1, ourShader, translateMatrix);
-        wall(VAO, ourShader, translateMatrix); 
-        wall(VAO, ourShader, glm::translate(identityMatrix, glm::vec3(14.7f, -0.5f,-0.2f)));
-        wall2(VAO, ourShader, translateMatrix);
-        floor(VAO, ourShader, translateMatrix);
-        // Modelling Transformation
-       
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.0f, 0.8f, translate_Z));
+        glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, scaleMatrix, model;
         rotateXMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_X), glm::vec3(1.0f, 0.0f, 0.0f));
-        rotateYMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
         rotateZMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Z), glm::vec3(0.0f, 0.0f, 1.0f));
-        scaleMatrix = glm::scale(identityMatrix, glm::vec3(1.0f, 1.0f, 1.0f));
-        model = translateMatrix * rotateXMatrix * rotateYMatrix * rotateZMatrix * scaleMatrix;
-
-
-        //For fan
-
-        fan_scaleMatrix = glm::scale(identityMatrix, glm::vec3(2.0f, .01f, .1f));
-        Fan_rotateYMatrix = glm::rotate(identityMatrix, glm::radians(Fan_rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
-        fan_model = translateMatrix * rotateXMatrix * Fan_rotateYMatrix * rotateZMatrix * fan_scaleMatrix;
-        ourShader.setMat4("model", fan_model);
-
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        fan_scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.1f, .01f, 3.0f));
-        fan_model = translateMatrix * rotateXMatrix * Fan_rotateYMatrix * rotateZMatrix * fan_scaleMatrix;
-        ourShader.setMat4("model", fan_model);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        fan_scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.30f, 0.20f, 0.30f));
-        fan_model = translateMatrix * rotateXMatrix * Fan_rotateYMatrix * rotateZMatrix * fan_scaleMatrix;
-        ourShader.setMat4("model", fan_model);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0); Fan_rotateAngle_Y += 0.1f;
-
-
-        glBindVertexArray(VAO);
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.0f, 1.0f, translate_Z));
-        //rotateYMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
-        scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.09f, 1.0f, 0.1f));
-        model = translateMatrix * rotateXMatrix * rotateYMatrix * rotateZMatrix * scaleMatrix;
-        ourShader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        
-      
-        //for table
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-1.30f, 0.0f, 0.0f));
-        table_scaleMatrix= glm::scale(translateMatrix, glm::vec3(1.0f, 0.2f, 1.0f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        ourShader.setVec3("color", glm::vec3(0.4f, 0.2f, 0.0f));  
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-       
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-1.5f, -0.25f, -0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.2f, 1.0f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        ourShader.setVec3("color", glm::vec3(0.6f, 0.4f, 0.2f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-1.1f, -0.25f, -0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.2f, 1.0f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-1.1f, -0.25f, 0.2f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.2f, 1.0f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-1.5f, -0.25f, 0.2f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.2f, 1.0f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        //for drawer
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.8f, 0.6f, -5.0f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(2.0f, 4.2f, 2.0f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);  ourShader.setVec3("color", glm::vec3(0.7f, 0.0f, 0.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(1.0f, 0.2f, 2.5f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);  ourShader.setVec3("color", glm::vec3(1.0f, 1.0f, 1.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.8f, -0.0f, -5.0f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(1.0f, 0.2f, 2.5f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);  ourShader.setVec3("color", glm::vec3(1.0f, 1.0f, 1.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(0.8f, 1.3f, -5.0f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(1.0f, 0.2f, 2.5f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);  ourShader.setVec3("color", glm::vec3(1.0f, 1.0f, 1.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        //for chair
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.805f, -0.15f, 0.0f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.5f, 0.2f, 1.0f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);  ourShader.setVec3("color", glm::vec3(0.7f, 0.0f, 0.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);  
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.89f, -0.35f, -0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.15f, 0.68f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model); ourShader.setVec3("color", glm::vec3(1.0f, 0.4f, 0.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.89f, -0.35f, 0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.15f, 0.68f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.73f, -0.35f, 0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.15f, 0.68f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.73f, -0.35f, -0.20f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.15f, 0.68f, 0.2f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-        translateMatrix = glm::translate(identityMatrix, glm::vec3(-0.72f, 0.1f, -0.0f));
-        table_scaleMatrix = glm::scale(translateMatrix, glm::vec3(0.15f, 1.0f, 1.0f));
-        model = table_scaleMatrix; ourShader.setMat4("model", model); ourShader.setVec3("color", glm::vec3(1.0f, 0.0f, 0.0f));
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-  //rotateYMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
-         
 
         //Axis line draw
         {
@@ -497,152 +716,591 @@ int main()
             glUniform3f(glGetUniformLocation(ourShader.ID, "lineColor"), 0.0f, 0.0f, 0.0f);
   //          glDrawArrays(GL_LINES, 4, 2);
         }
+        // picking: the batches keep the main pass culling, the ID pass only rasterizes the one
+        // pixel under the cursor; the result is read back a frame or more later
+        int windowWidth, windowHeight;
+        glfwGetWindowSize(window, &windowWidth, &windowHeight);
+        glm::vec2 pickCursor = benchPhase == 1 ? 0.5f * glm::vec2(windowWidth, windowHeight) : frame.pickCursor;
+        if ((frame.pick || benchPhase == 1) && windowWidth > 0 && windowHeight > 0 && picker.begin()) {
+            pickShader.use();
+            pickShader.setMat4("pickViewProjection", pickMatrix(pickCursor.x / windowWidth, pickCursor.y / windowHeight, fbWidth, fbHeight) * frame.viewProjection);
+            world.draw();
+            animated.draw();
+            picker.end();
+        }
+        if (post.Features != 0) {
+            sceneTarget.resolve();
+            post.apply(sceneTarget.ColorTexture, renderWidth, renderHeight, fbWidth, fbHeight);
+        }
+        else
+            sceneTarget.end(fbWidth, fbHeight);
+        // golden images are the window as shown, composite pass included
+        if (frame.goldenPose >= 0) {
+            glFinish();
+            golden.endFrame(frame.goldenPose, frame.goldenFrame, fbWidth, fbHeight, frameStart, glfwGetTime());
+        }
+        if (reverseZ)
+            endReverseZ();
+        gpuTimer.end();
+        if (benchPhase >= 0)
+            benchCpuMs[benchPhase] += 1000.0 * (glfwGetTime() - frameStart);
         glfwSwapBuffers(window);
+        latency.swapped(frames, frame.inputTime);
+        // low latency: nothing queues up behind this frame and the next one only takes input
+        // once it is done; the limiter also waits before the input is sampled, not after
+        if (pipeline.Lockstep)
+            latency.waitForGpu();
+        limiter.wait();
         glfwPollEvents();
+        pipeline.finish();
+        // deletions the GPU is done with; this frame's lists are all gone by now
+        gpuResources().endFrame();
+        frameArena().reset();
+        if (telemetry.enabled())
+            telemetry.frame(glfwGetTime(), textureStreamer.residentBytes());
+        if (gpuReportRequested.exchange(false)) {
+            gpuResources().report();
+            std::cout << "  streamed textures: " << textureStreamer.residentBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+        }
+    }
+    size_t allocations = heapAllocations() - allocationsBefore;
+
+    pipeline.stop();
+    simulation.join();
+    if (settings.Frames > 0 && frames == settings.Frames)
+        std::cout << settings.describe() << ": " << frames << " frames, " << 1000.0 * frameTimeTotal / std::max(frames - 1, 1)
+            << " ms per frame, render scale " << resolution.Scale << std::endl;
+    if (latency.Frames > 0 && (settings.Frames > 0 || input.replayFinished()))
+        std::cout << "input to photon: " << latency.averageMs() << " ms average, " << latency.MaxMs << " ms max over "
+            << latency.Frames << " frames with input" << std::endl;
+    if (flying)
+        std::cout << "flythrough: " << frames << " frames, " << 1000.0 * frameTimeTotal / std::max(frames - 1, 1) << " ms per frame, render scale " << resolution.Scale << std::endl;
+    if (input.replayFinished())
+        std::cout << "replay: " << frames << " frames, " << 1000.0 * frameTimeTotal / std::max(frames - 1, 1) << " ms per frame, render scale " << resolution.Scale << std::endl;
+    if (benchPicking) {
+        for (int phase = 0; phase < 2; phase++)
+            std::cout << (phase == 0 ? "without picking: " : "picking every frame: ") << benchCpuMs[phase] / PICK_BENCH_FRAMES << " ms CPU, "
+                << benchGpuMs[phase] / std::max(benchGpuFrames[phase], 1) << " ms GPU per frame" << std::endl;
+        std::cout << benchPicks << " of " << PICK_BENCH_FRAMES << " picks read back" << std::endl;
     }
+    if (countAllocations)
+        std::cout << "allocations: " << allocations << " in " << ALLOCATION_COUNTED_FRAMES << " frames after warm-up (arena peak "
+            << frameArena().Peak << " bytes)" << std::endl;
 
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+    world.release();
+    pipeline.slot(0).animated.release();
+    pipeline.slot(1).animated.release();
+    meshBuffer.release();
+    sunShadow.release();
+    spotShadow.release();
+    textureStreamer.release();
+    sceneTarget.release();
+    post.release();
+    transparency.release();
+    gpuTimer.release();
+    latency.release();
+    telemetry.release();
+    picker.release();
+    gpuResources().destroy(axisArray);
+    gpuResources().destroy(axisBuffer);
+    gpuResources().release();
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
-    return 0;
-}
-void wall(unsigned int VAO, Shader ourShader, glm::mat4 isha) {
-    glm::mat4 identityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-    glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, Fan_rotateYMatrix, bed_rotateMatrix, scaleMatrix,
-        fan_scaleMatrix, bed_scaleMatrix, model, fan_model, bed_model, table_scaleMatrix;
-    translateMatrix = glm::translate(identityMatrix, glm::vec3(-10.0f, 3.43f, -4.0f));
-    scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.5f, 13.8f, 20.0f));
-    model = translateMatrix * isha * scaleMatrix;
-    ourShader.setMat4("model", model);
-    ourShader.setVec3("color", glm::vec3(0.8f, 0.5f, 0.2f));
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-}
-void wall2(unsigned int VAO, Shader ourShader, glm::mat4 isha) {
-    glm::mat4 identityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-    glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, Fan_rotateYMatrix, bed_rotateMatrix, scaleMatrix,
-        fan_scaleMatrix, bed_scaleMatrix, model, fan_model, bed_model, table_scaleMatrix;
-    translateMatrix = glm::translate(identityMatrix, glm::vec3(-3.5f, 3.33f, -10.0f));
-    scaleMatrix = glm::scale(identityMatrix, glm::vec3(33.7f, 13.8f, 0.5f));
-    model = translateMatrix * isha * scaleMatrix;
-    ourShader.setMat4("model", model);
-    ourShader.setVec3("color", glm::vec3(0.8f, 0.6f, 0.2f));
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    return (golden.Failures > 0 || (countAllocations && allocations > 0)) ? 1 : 0;
 }
+// simulation thread: runs the fixed steps that are due, then fills the next frame's snapshot
+// ------------------------------------------------------------------------------------------
+void simulationLoop(FramePipeline<FrameState>* pipeline)
+{
+    HeapScope heapScope(HEAP_SIMULATION);
+    // the layout comes from a scene file parsed in the background
+    Scene scene;
+    SceneLoader sceneLoader;
+    sceneLoader.load(settings.Scene);
+    bool sceneLoading = true;
+    animator.load(settings.Animation);
+
+    // rooms and doorways of the scene; doorways marked "auto" are found in the walls once the
+    // scene has loaded. Without a portal file the main pass culls against the view frustum only.
+    PortalGraph portals;
+    portals.load(settings.Portals);
+    std::vector<InstanceBounds> staticBounds;
+
+    double simTime = 0.0;
+    int goldenPose = 0, goldenFrame = 0;
+    double flightStart = -1.0;
+    int selectedId = 0;
+    while (pipeline->beginWrite())
+    {
+        FrameState& frame = pipeline->back();
+
+        // fixed-step simulation: every input event is handled in the step it happened in
+        int steps = 0;
+        while (simTime + SIM_STEP <= input.now() && steps < SIM_MAX_STEPS) {
+            simTime += SIM_STEP;
+            input.step(simTime, handleInput);
+            simulate((float)SIM_STEP);
+            steps++;
+        }
+        if (input.now() - simTime > SIM_STEP)
+            input.skip(input.now() - simTime);
+        if (input.replayFinished())
+            quitRequested = true;
+
+        // static placements go to the GL thread's world partition, animated ones (the fan
+        // blades) are instanced here every frame
+        frame.newStatic.clear();
+        frame.newStaticPrefabs.clear();
+        if (sceneLoading) {
+            std::vector<SceneChunk> chunks;
+            sceneLoading = sceneLoader.poll(chunks);
+            for (size_t i = 0; i < chunks.size(); i++)
+                scene.merge(chunks[i], frame.newStatic);
+            for (size_t i = 0; i < frame.newStatic.size(); i++) {
+                const ScenePrefab& prefab = scene.Prefabs[frame.newStatic[i].prefab];
+                frame.newStaticPrefabs.push_back(prefab);
+                for (size_t j = 0; j < prefab.boxes.size(); j++) {
+                    int mesh = meshes->find(prefab.boxes[j].mesh);
+                    if (mesh >= 0)
+                        staticBounds.push_back(meshes->bounds(mesh, frame.newStatic[i].transform * prefab.boxes[j].transform));
+                }
+            }
+            if (!sceneLoading)
+                portals.derive(staticBounds);
+        }
 
+        // golden run: once the scene is in, the camera holds every pose for a fixed number of frames
+        frame.goldenPose = -1;
+        if (goldenRunning && !sceneLoading) {
+            if (goldenFrame == GoldenRun::framesPerPose()) {
+                goldenPose++;
+                goldenFrame = 0;
+            }
+            if (goldenPose < (int)golden.Poses.size()) {
+                const GoldenPose& pose = golden.Poses[goldenPose];
+                camera.SetPose(pose.position, pose.yaw, pose.pitch, pose.roll);
+                frame.goldenPose = goldenPose;
+                frame.goldenFrame = goldenFrame++;
+            }
+            else
+                quitRequested = true;
+        }
 
-void floor(unsigned int VAO, Shader ourShader, glm::mat4 isha) {
-    glm::mat4 identityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-    glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, Fan_rotateYMatrix, bed_rotateMatrix, scaleMatrix,
-        fan_scaleMatrix, bed_scaleMatrix, model, fan_model, bed_model, table_scaleMatrix;
-    translateMatrix = glm::translate(identityMatrix, glm::vec3(-3.0f, 0.0f, -4.0f));
-    scaleMatrix = glm::scale(identityMatrix, glm::vec3(30.0f, 0.1f, 20.0f));
-    model = translateMatrix * isha * scaleMatrix;
-    ourShader.setMat4("model", model);
-    ourShader.setVec3("color", glm::vec3(0.9f, 0.7f, 0.5f));
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-}
+        // flythrough: once the scene is in, the camera follows the path on the simulation clock
+        if (flying && !sceneLoading) {
+            if (flightStart < 0.0)
+                flightStart = simTime;
+            GoldenPose pose;
+            if (flythrough.at((float)(simTime - flightStart), pose))
+                camera.SetPose(pose.position, pose.yaw, pose.pitch, pose.roll);
+            else
+                quitRequested = true;
+        }
 
-void drawbed(unsigned int VAO1,Shader ourShader, glm::mat4 isha) {
-    glm::mat4 identityMatrix = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-    glm::mat4 translateMatrix, rotateXMatrix, rotateYMatrix, rotateZMatrix, Fan_rotateYMatrix, bed_rotateMatrix, scaleMatrix,
-        fan_scaleMatrix, bed_scaleMatrix, model, fan_model, bed_model, table_scaleMatrix;
-    translateMatrix = glm::translate(identityMatrix, glm::vec3(0.75f, 0.1f, 0.5f));
-    // rotateXMatrix = glm::rotate(identityMatrix, glm::radians(180.0f), glm::vec3(0.0f, .0f, 0.0f));
-    bed_scaleMatrix = glm::scale(identityMatrix, glm::vec3(1.0f, .2f, .5f));
-    bed_model = isha * translateMatrix * bed_scaleMatrix;
-    ourShader.setMat4("model", bed_model);   ourShader.setVec3("color", glm::vec3(1.0f, 0.984f, 0.0f));
-    glBindVertexArray(VAO1);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-    identityMatrix = glm::translate(identityMatrix, glm::vec3(1.25f, 0.3f, 0.5f));
-    //rotateYMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
-    bed_scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.08f, 0.60f, 0.5f));
-    //translateMatrix = glm::translate(bed_scaleMatrix, glm::vec3(0.0f, 0.0f, 0.0f));
-    bed_model = isha * bed_scaleMatrix;
-    ourShader.setMat4("model", bed_model); ourShader.setVec3("color", glm::vec3(0.118f, 1.0f, 0.0f));
-    glBindVertexArray(VAO1);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-    identityMatrix = glm::translate(identityMatrix, glm::vec3(-1.0f, -0.15f, 0.0f));
-    //rotateYMatrix = glm::rotate(identityMatrix, glm::radians(rotateAngle_Y), glm::vec3(0.0f, 1.0f, 0.0f));
-    bed_scaleMatrix = glm::scale(identityMatrix, glm::vec3(0.08f, 0.30f, 0.5f));
-    //translateMatrix = glm::translate(bed_scaleMatrix, glm::vec3(0.0f, 0.0f, 0.0f));
-    bed_model = isha * bed_scaleMatrix;
-    ourShader.setMat4("model", bed_model);
-    glBindVertexArray(VAO1);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        // camera matrices and frustum, each rebuilt only when the camera changed since the last frame
+        activeCamera->SetReverseZ(reverseZ);
+        activeCamera->SetPerspective(camera.Zoom, windowAspect, settings.Near, settings.Far);
+        //glm::mat4 projection = glm::ortho(-2.0f, +2.0f, -1.5f, +1.5f, 0.1f, 100.0f);
+        frame.projection = activeCamera->GetProjectionMatrix();
+        frame.view = activeCamera->GetViewMatrix();
+        frame.viewProjection = activeCamera->GetViewProjectionMatrix();
+        frame.frustum = activeCamera->GetFrustum();
+        frame.cameraPosition = activeCamera->GetEyePosition();
+        frame.zoom = camera.Zoom;
+        frame.aspect = windowAspect;
+
+        // picking: the click of this frame goes to the GL thread, a finished pick changes the selection
+        frame.pick = pickRequested;
+        frame.pickCursor = glm::vec2(lastX, lastY);
+        pickRequested = false;
+        int picked = pickedId.exchange(-1);
+        if (picked >= 0 && picked != selectedId) {
+            selectedId = picked < (int)scene.PlacementPrefabs.size() ? picked : 0;
+            if (selectedId != 0)
+                std::cout << "selected " << scene.PlacementPrefabs[selectedId] << " (placement " << selectedId << ")" << std::endl;
+        }
+        frame.selectedId = selectedId;
+
+        animator.evaluate();
+        frame.animated.clear();
+        for (size_t i = 0; i < scene.Animated.size(); i++) {
+            const ScenePlacement& placement = scene.Animated[i];
+            frame.animated.setPickId(placement.id);
+            addPlacement(frame.animated, scene.Prefabs[placement.prefab], placement.transform * animationTransform(placement.animation));
+        }
+        portals.traverse(frame.cameraPosition, frame.viewProjection, frame.frustum, frame.visibility);
 
+        frame.inputTime = input.takeOldest();
+        pipeline->publish();
+        frameArena().reset();
+    }
+    sceneLoader.stop();
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
-void processInput(GLFWwindow* window)
-{
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+// the cube and bed meshes every scene box is made of
+// ----------------------------------------------------
+void addMeshes(MeshBuffer& meshBuffer) {
+    float cube_vertices[] = {
+       -0.25f, -0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
+        0.25f, -0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
+        0.25f, 0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
+        -0.25f, 0.25f, -0.25f, 0.0f, 0.0f, 0.0f,
+        -0.25f, -0.25f, 0.25f, 0.3f, 0.8f, 0.5f,
+        0.25f, -0.25f, 0.25f, 0.5f, 0.4f, 0.3f,
+        0.25f, 0.25f, 0.25f, 0.2f, 0.7f, 0.3f,
+        -0.25f, 0.25f, 0.25f, 0.6f, 0.2f, 0.8f
+    };
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-        camera.ProcessKeyboard(FORWARD, deltaTime);
-    }
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-        camera.ProcessKeyboard(BACKWARD, deltaTime);
-    }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        camera.ProcessKeyboard(LEFT, deltaTime);
-    }
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        camera.ProcessKeyboard(RIGHT, deltaTime);
+    float bed[] = {
+     -0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 0.0f,
+      0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 0.0f,
+      0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
+      -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.0f,
+      -0.5f, 0.5f, 0.5f, 0.3f, 0.8f, 0.5f,
+      0.5f, 0.5f, 0.5f, 0.5f, 0.4f, 0.3f,
+      0.5f, 0.5f, -0.5f, 0.2f, 0.7f, 0.3f,
+      -0.5f, 0.5f, -0.5f, 0.6f, 0.2f, 0.8f
+    };
+    unsigned int bed_indices[] = {
+        0,1,2, 0,3,2, 0,1,5, 0,4,5, 0,3,7, 0,4,7, 2,1,5, 2,6,5, 3,2,7, 7,6,2, 4,5,6, 6,7,4,
+    };
+
+    unsigned int cube_indices[] = {
+         0, 3, 2,
+        2, 1, 0,
+
+        1, 2, 6,
+        6, 5, 1,
+
+        5, 6, 7,
+        7 ,4, 5,
+
+        4, 7, 3,
+        3, 0, 4,
+
+        6, 2, 3,
+        3, 7, 6,
+
+        1, 5, 4,
+        4, 0, 1
+    };
+
+    meshBuffer.add("cube", cube_vertices, 8, cube_indices, 36, 0.25f);
+    meshBuffer.add("bed", bed, 8, bed_indices, 36, 0.5f);
+}
+
+// instances every box of a prefab with the given placement transform
+// --------------------------------------------------------------------
+void addPlacement(InstanceBatch& batch, const ScenePrefab& prefab, const glm::mat4& model) {
+    for (size_t i = 0; i < prefab.boxes.size(); i++) {
+        const SceneBox& box = prefab.boxes[i];
+        int mesh = meshes->find(box.mesh);
+        if (mesh < 0)
+            continue;
+        batch.setMesh(mesh);
+        batch.setColor(box.color);
+        batch.setSurface(atlas.find(box.surface), box.textureScale);
+        batch.setOpacity(box.opacity);
+        batch.add(model * box.transform);
     }
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-        camera.ProcessKeyboard(UP, deltaTime);
+}
+
+// resolves a scene file animation binding, a node of the animation file, to its pose this frame
+// -------------------------------------------------------------------------------------------
+glm::mat4 animationTransform(const std::string& binding) {
+    int node = animator.find(binding);
+    if (node < 0)
+        return glm::mat4(1.0f);
+    return animator.World(node);
+}
+
+// renders the shadow layers: static casters only into dirty cached layers, dynamic casters every frame;
+// transparent boxes let the light through and cast none
+// -----------------------------------------------------------------------------------------------------
+void renderShadows(ShadowMap& shadow, Shader depthShader, WorldPartition& world, InstanceBatch& animated) {
+    depthShader.use();
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    for (int i = 0; i < shadow.Layers; i++) {
+        depthShader.setMat4("lightSpace", shadow.LightSpace[i]);
+        Frustum frustum(shadow.LightSpace[i]);
+        if (shadow.StaticDirty[i]) {
+            shadow.beginLayer(shadow.StaticDepth, i);
+            world.cull(frustum);
+            world.draw(DRAW_OPAQUE);
+            shadow.StaticDirty[i] = false;
+        }
+        shadow.beginLayer(shadow.DynamicDepth, i);
+        animated.cull(frustum);
+        animated.draw(DRAW_OPAQUE);
     }
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-        camera.ProcessKeyboard(DOWN, deltaTime);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+// uploads light parameters and binds the shadow maps for the main pass
+// --------------------------------------------------------------------
+void setLighting(Shader ourShader, const CascadedShadowMap& sunShadow, const ShadowMap& spotShadow) {
+    ourShader.setFloat("ambient", AMBIENT);
+    ourShader.setVec3("sunDirection", glm::normalize(SUN_DIRECTION));
+    ourShader.setVec3("sunColor", SUN_COLOR);
+    ourShader.setVec3("spotPosition", SPOT_POSITION);
+    ourShader.setVec3("spotDirection", SPOT_DIRECTION);
+    ourShader.setVec3("spotColor", SPOT_COLOR);
+    ourShader.setFloat("spotInnerCutoff", cos(glm::radians(SPOT_INNER_ANGLE)));
+    ourShader.setFloat("spotOuterCutoff", cos(glm::radians(SPOT_OUTER_ANGLE)));
+
+    // array element names are built once; long ones would be a heap allocation every frame
+    static std::string lightSpaceNames[NUM_CASCADES], splitNames[NUM_CASCADES];
+    if (lightSpaceNames[0].empty()) {
+        for (int i = 0; i < NUM_CASCADES; i++) {
+            lightSpaceNames[i] = "sunLightSpace[" + to_string(i) + "]";
+            splitNames[i] = "cascadeSplits[" + to_string(i) + "]";
+        }
     }
-    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
-        camera.ProcessKeyboard(P_UP, deltaTime);
+    ourShader.setBool("shadowsEnabled", true);
+    for (int i = 0; i < NUM_CASCADES; i++) {
+        ourShader.setMat4(lightSpaceNames[i], sunShadow.LightSpace[i]);
+        ourShader.setFloat(splitNames[i], sunShadow.Splits[i]);
     }
-    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-        camera.ProcessKeyboard(P_DOWN, deltaTime);
+    ourShader.setMat4("spotLightSpace", spotShadow.LightSpace[0]);
+    sunShadow.bind(ourShader, "sun", 1);
+    spotShadow.bind(ourShader, "spot", 3);
+}
+
+// tells the streamer how close each textured box is; the nearest one decides the finest mip level worth keeping resident.
+// Only resident cells are considered, and boxes culled by the last main pass are skipped.
+// ------------------------------------------------------------------------------------------------------------------------
+void requestSurfaceMips(const WorldPartition& world, glm::vec3 cameraPosition, float zoom, int viewportHeight) {
+    FrameVector<const InstanceBatch*> batches(frameArena());
+    batches.reserve(world.cellCount());
+    world.residentBatches(batches);
+    for (size_t b = 0; b < batches.size(); b++) {
+        const InstanceBatch& batch = *batches[b];
+        for (size_t i = 0; i < batch.Instances.size(); i++) {
+            const InstanceData& instance = batch.Instances[i];
+            if (instance.surface.w < 0.0f || batch.Commands[i].instanceCount == 0)
+                continue;
+            const InstanceBounds& bounds = batch.Bounds[i];
+            glm::vec3 nearest = glm::clamp(cameraPosition, bounds.center - bounds.halfSize, bounds.center + bounds.halfSize);
+            float distance = glm::max(glm::distance(cameraPosition, nearest), 0.1f);
+            float pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(zoom) * 0.5f) * distance);
+            // texels of the region itself, so the level matches what the shader samples inside the rect
+            float texels = atlas.LayerSize * instance.atlasRect.z;
+            textures->request(atlasTexture, texels * instance.textureScale / pixelsPerUnit);
+        }
     }
-    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS) {
-        camera.ProcessKeyboard(Y_LEFT, deltaTime);
+}
+
+// input events, in the simulation step they happened in
+// -------------------------------------------------------
+void handleInput(const InputEvent& event)
+{
+    if (event.type == INPUT_KEY && event.action == GLFW_PRESS) {
+        if (event.key == GLFW_KEY_ESCAPE)
+            quitRequested = true;
+        if (event.key == GLFW_KEY_M)
+            gpuReportRequested = true;
+        if (event.key == GLFW_KEY_G)
+            fan_turn = !fan_turn;
+        if (event.key == GLFW_KEY_F) {
+            rotate_around = !rotate_around;
+            if (rotate_around)
+                camera.BeginOrbit(ORBIT_TARGET);
+        }
     }
-    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) {
-        camera.ProcessKeyboard(Y_RIGHT, deltaTime);
+    else if (event.type == INPUT_CURSOR) {
+        if (firstMouse)
+        {
+            lastX = event.x;
+            lastY = event.y;
+            firstMouse = false;
+        }
+
+        float xoffset = event.x - lastX;
+        float yoffset = lastY - event.y; // reversed since y-coordinates go from bottom to top
+
+        lastX = event.x;
+        lastY = event.y;
+
+        camera.ProcessMouseMovement(xoffset, yoffset);
     }
-    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
-        camera.ProcessKeyboard(R_LEFT, deltaTime);
+    else if (event.type == INPUT_SCROLL) {
+        camera.ProcessMouseScroll(event.y);
     }
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-        camera.ProcessKeyboard(R_RIGHT, deltaTime);
+    else if (event.type == INPUT_BUTTON) {
+        if (event.key == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS)
+            pickRequested = true;
     }
-    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
-        if (!fan_turn) {
-            fan_turn = true;
-        }
-        else {
-            fan_turn = false;
+}
+
+// one fixed simulation step: camera movement for the held keys, then the animations
+// ---------------------------------------------------------------------------------
+void simulate(float step)
+{
+    static const int keys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_E, GLFW_KEY_R,
+        GLFW_KEY_X, GLFW_KEY_C, GLFW_KEY_Y, GLFW_KEY_V, GLFW_KEY_Z, GLFW_KEY_Q };
+    static const Camera_Movement movements[] = { FORWARD, BACKWARD, LEFT, RIGHT, UP, DOWN,
+        P_UP, P_DOWN, Y_LEFT, Y_RIGHT, R_LEFT, R_RIGHT };
+    for (int i = 0; i < 12; i++)
+        if (input.down(keys[i]))
+            camera.ProcessKeyboard(movements[i], step);
+    if (rotate_around)
+        camera.Orbit(ORBIT_SPEED * step, 0.0f);
+
+    animator.advance(step);
+}
+
+// --bench-camera: camera updates per second for moving, turning and orbiting, each followed by
+// the view-projection fetch the culling does every frame
+// ----------------------------------------------------------------------------------------------
+int benchmarkCamera()
+{
+    const int updates = 2000000;
+    const char* names[] = { "move", "turn", "orbit" };
+    float checksum = 0.0f;
+    for (int test = 0; test < 3; test++) {
+        Camera bench(glm::vec3(0.0f, 0.0f, 3.0f));
+        bench.BeginOrbit(ORBIT_TARGET);
+        bench.SetPerspective(bench.Zoom, (float)settings.Width / (float)settings.Height, settings.Near, settings.Far);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < updates; i++) {
+            if (test == 0)
+                bench.ProcessKeyboard((i & 1) ? FORWARD : BACKWARD, 0.001f);
+            else if (test == 1)
+                bench.ProcessKeyboard((i & 1) ? Y_LEFT : P_UP, 0.001f);
+            else
+                bench.Orbit(0.001f, 0.0f);
+            checksum += bench.GetFrustum().Planes[4].w;
         }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << names[test] << ": " << updates / seconds / 1e6 << " M updates/s" << std::endl;
     }
-    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
-        if (!rotate_around) {
-            rotate_around = true;
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+    return 0;
+}
+
+// --bench-animation: Animator::evaluate() over a room full of fans, doors and drawers, a quarter
+// of them standing still, with the time per frame and per playing track
+// ----------------------------------------------------------------------------------------------
+int benchmarkAnimation()
+{
+    const int props = 3000;
+    const int frames = 2000;
+    Animator bench;
+    for (int i = 0; i < props; i++) {
+        std::string name = std::to_string(i);
+        int root = bench.addNode("prop" + name, -1, glm::vec3((float)(i % 50), 0.0f, (float)(i / 50)), glm::quat(), glm::vec3(1.0f));
+        int clip = bench.addClip("move" + name, 4.0f, true);
+        if (i % 3 == 0) {
+            // fan: blades under the mount, a key every 45 degrees
+            int blades = bench.addNode("blades" + name, root, glm::vec3(0.0f, -0.2f, 0.0f), glm::quat(), glm::vec3(1.0f));
+            for (int k = 0; k <= 8; k++) {
+                glm::quat q = Animator::eulerRotation(glm::vec3(0.0f, 45.0f * k, 0.0f));
+                bench.addKey(clip, blades, ANIMATION_ROTATE, 0.5f * k, glm::vec4(q.x, q.y, q.z, q.w));
+            }
+        }
+        else if (i % 3 == 1) {
+            // door: swings open and shut, blended half and half with a rattle
+            int door = bench.addNode("door" + name, root, glm::vec3(0.5f, 0.0f, 0.0f), glm::quat(), glm::vec3(1.0f));
+            for (int k = 0; k <= 2; k++) {
+                glm::quat q = Animator::eulerRotation(glm::vec3(0.0f, k == 1 ? 90.0f : 0.0f, 0.0f));
+                bench.addKey(clip, door, ANIMATION_ROTATE, 2.0f * k, glm::vec4(q.x, q.y, q.z, q.w));
+            }
+            int rattle = bench.addClip("rattle" + name, 0.2f, true);
+            for (int k = 0; k <= 2; k++)
+                bench.addKey(rattle, door, ANIMATION_TRANSLATE, 0.1f * k, glm::vec4(0.5f, 0.0f, k == 1 ? 0.01f : 0.0f, 0.0f));
+            if (i % 4 != 3)
+                bench.play(rattle, 0.5f);
         }
         else {
-            rotate_around = false;
+            // drawer: slides out and back in
+            int drawer = bench.addNode("drawer" + name, root, glm::vec3(0.0f), glm::quat(), glm::vec3(1.0f));
+            for (int k = 0; k <= 2; k++)
+                bench.addKey(clip, drawer, ANIMATION_TRANSLATE, 2.0f * k, glm::vec4(0.0f, 0.0f, k == 1 ? 0.4f : 0.0f, 0.0f));
         }
+        if (i % 4 != 3)
+            bench.play(clip, 1.0f, 1.0f + 0.01f * (i % 7));
+    }
+
+    float checksum = 0.0f;
+    long long tracks = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        bench.advance(1.0f / 60.0f);
+        bench.evaluate();
+        tracks += bench.ActiveTracks;
+        checksum += bench.World((int)bench.Nodes.size() - 1)[3].z;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << props << " props, " << bench.Nodes.size() << " nodes, " << bench.ActiveTracks << " tracks playing, "
+        << bench.UpdatedNodes << " nodes posed per frame" << std::endl;
+    std::cout << 1e6 * seconds / frames << " us per frame, " << 1e9 * seconds / tracks << " ns per track" << std::endl;
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+    return 0;
+}
+
+// --software: the main pass on the CPU (see software_rasterizer.h) from the start camera once the
+// whole scene has loaded, written to a PPM image; no window or GL context is created
+// ----------------------------------------------------------------------------------------------
+int renderSoftware(const std::string& path, int threads)
+{
+    MeshBuffer meshBuffer;
+    addMeshes(meshBuffer);
+    meshes = &meshBuffer;
+
+    Scene scene;
+    SceneLoader sceneLoader;
+    sceneLoader.load(settings.Scene);
+    std::vector<ScenePlacement> placements;
+    for (;;) {
+        std::vector<SceneChunk> chunks;
+        bool loading = sceneLoader.poll(chunks);
+        for (size_t i = 0; i < chunks.size(); i++)
+            scene.merge(chunks[i], placements);
+        if (!loading)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sceneLoader.stop();
+
+    animator.load(settings.Animation);
+    animator.evaluate();
+
+    InstanceBatch batch(meshBuffer);
+    for (size_t i = 0; i < placements.size(); i++)
+        addPlacement(batch, scene.Prefabs[placements[i].prefab], placements[i].transform);
+    for (size_t i = 0; i < scene.Animated.size(); i++) {
+        const ScenePlacement& placement = scene.Animated[i];
+        addPlacement(batch, scene.Prefabs[placement.prefab], placement.transform * animationTransform(placement.animation));
     }
 
+    activeCamera->SetPerspective(camera.Zoom, (float)settings.Width / (float)settings.Height, settings.Near, settings.Far);
+    int visible = batch.cull(activeCamera->GetFrustum());
+
+    SoftwareRasterizer rasterizer(settings.Width, settings.Height, threads);
+    SoftwareLighting& lighting = rasterizer.Lighting;
+    lighting.ambient = AMBIENT;
+    lighting.sunDirection = glm::normalize(SUN_DIRECTION);
+    lighting.sunColor = SUN_COLOR;
+    lighting.spotPosition = SPOT_POSITION;
+    lighting.spotDirection = glm::normalize(SPOT_DIRECTION);
+    lighting.spotColor = SPOT_COLOR;
+    lighting.spotInnerCutoff = cos(glm::radians(SPOT_INNER_ANGLE));
+    lighting.spotOuterCutoff = cos(glm::radians(SPOT_OUTER_ANGLE));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    rasterizer.setMatrices(activeCamera->GetViewMatrix(), activeCamera->GetProjectionMatrix());
+    rasterizer.clear(glm::vec3(1.0f, 1.0f, 1.0f));
+    rasterizer.draw(meshBuffer, batch);
+    rasterizer.finish();
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "software: " << visible << " boxes, " << milliseconds << " ms on "
+        << rasterizer.Threads << " threads" << std::endl;
+    return rasterizer.writeImage(path) ? 0 : -1;
 }
 
 
@@ -653,35 +1311,37 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    // the projection follows the new shape; a minimized window keeps the last one
+    if (width > 0 && height > 0)
+        windowAspect = (float)width / (float)height;
 }
 
 
-// glfw: whenever the mouse moves, this callback is called
-// -------------------------------------------------------
+// glfw: whenever the mouse moves, this callback is called; the camera turns in the next simulation step,
+// and the next click picks what is under the new position
+// ------------------------------------------------------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
-    float xpos = static_cast<float>(xposIn);
-    float ypos = static_cast<float>(yposIn);
-
-    if (firstMouse)
-    {
-        lastX = xpos;
-        lastY = ypos;
-        firstMouse = false;
-    }
-
-    float xoffset = xpos - lastX;
-    float yoffset = lastY - ypos; // reversed since y-coordinates go from bottom to top
-
-    lastX = xpos;
-    lastY = ypos;
+    input.cursor(xposIn, yposIn);
+}
 
-    camera.ProcessMouseMovement(xoffset, yoffset);
+// glfw: whenever a mouse button is pressed or released, this callback is called
+// -----------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    input.button(button, action);
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    camera.ProcessMouseScroll(static_cast<float>(yoffset));
+    input.scroll(xoffset, yoffset);
+}
+
+// glfw: whenever a key is pressed or released, this callback is called
+// --------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    input.key(key, action);
 }
@@ -0,0 +1,11 @@
+#version 330 core
+
+flat in uint PickId;
+
+out uint FragId;
+
+void main()
+{
+    // the placement the pixel belongs to, 0 where nothing was drawn
+    FragId = PickId;
+}
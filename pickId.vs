@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel;
+layout (location = 9) in uint aPickId;
+
+flat out uint PickId;
+
+uniform mat4 pickViewProjection;
+
+void main()
+{
+    gl_Position = pickViewProjection * aModel * vec4(aPos, 1.0f);
+    PickId = aPickId;
+}
@@ -0,0 +1,153 @@
+//
+//  picking.h
+//  3D Object Drawing
+//
+
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gpu_resources.h"
+
+#include <cmath>
+#include <iostream>
+
+// Default picking values
+const int PICK_READBACKS = 3;           // picks in flight; a request while all are busy waits a frame
+
+
+// Matrix that blows the pixel at (u, v) of a width x height view (0..1, origin top left, like
+// cursor positions) up to the whole viewport; applied after the projection, so a 1x1 target
+// sees exactly what that one pixel of the full view would
+inline glm::mat4 pickMatrix(float u, float v, int width, int height)
+{
+    float x = (std::floor(u * width) + 0.5f) / width * 2.0f - 1.0f;
+    float y = 1.0f - (std::floor(v * height) + 0.5f) / height * 2.0f;
+    glm::mat4 pick(1.0f);
+    pick[0][0] = (float)width;
+    pick[1][1] = (float)height;
+    pick[3][0] = -x * width;
+    pick[3][1] = -y * height;
+    return pick;
+}
+
+// Object under the cursor from an ID pass: the scene is drawn again with pickId.vs/.fs into a
+// 1x1 GL_R32UI target through pickMatrix(), so only the one pixel under the cursor is
+// rasterized, and the ID is copied into a pixel pack buffer. The copy is read a frame or more
+// later, once its fence has signaled, so picking never waits for the GPU.
+// GL thread: begin(), draw the batches, end(); poll() every frame.
+class GpuPicker
+{
+public:
+    GpuPicker() : next(0), oldest(0), pending(0)
+    {
+        for (int i = 0; i < PICK_READBACKS; i++)
+            fences[i] = 0;
+    }
+
+    // binds the ID target; false while every readback is still in flight
+    bool begin()
+    {
+        if (pending == PICK_READBACKS)
+            return false;
+        if (gpuResources().get(framebuffer) == 0)
+            allocate();
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(framebuffer));
+        gpuResources().countStateChange();
+        glViewport(0, 0, 1, 1);
+        GLuint nothing[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, nothing);
+        // cleared to whatever the depth state of the main pass clears to (reverse-Z or not)
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return true;
+    }
+
+    // starts copying the ID into this pick's buffer
+    void end()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gpuResources().get(buffers[next]));
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        next = (next + 1) % PICK_READBACKS;
+        pending++;
+    }
+
+    // the oldest finished pick: the ID under the cursor, 0 for the background
+    bool poll(unsigned int& id)
+    {
+        if (pending == 0)
+            return false;
+        GLenum status = glClientWaitSync(fences[oldest], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(fences[oldest]);
+        fences[oldest] = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gpuResources().get(buffers[oldest]));
+        glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(id), &id);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        oldest = (oldest + 1) % PICK_READBACKS;
+        pending--;
+        return true;
+    }
+
+    void release()
+    {
+        for (int i = 0; i < PICK_READBACKS; i++)
+        {
+            if (fences[i] != 0)
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+            gpuResources().destroy(buffers[i]);
+        }
+        gpuResources().destroy(framebuffer);
+        gpuResources().destroy(ids);
+        gpuResources().destroy(depth);
+        next = oldest = pending = 0;
+    }
+
+private:
+    GpuHandle framebuffer;
+    GpuHandle ids;
+    GpuHandle depth;
+    GpuHandle buffers[PICK_READBACKS];
+    GLsync fences[PICK_READBACKS];
+    int next;
+    int oldest;
+    int pending;
+
+    void allocate()
+    {
+        ids = gpuResources().create(GPU_RENDERBUFFER, "pick ids");
+        glBindRenderbuffer(GL_RENDERBUFFER, gpuResources().get(ids));
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, 1, 1);
+        depth = gpuResources().create(GPU_RENDERBUFFER, "pick depth");
+        glBindRenderbuffer(GL_RENDERBUFFER, gpuResources().get(depth));
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, 1, 1);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        gpuResources().setBytes(ids, 4);
+        gpuResources().setBytes(depth, 4);
+
+        framebuffer = gpuResources().create(GPU_FRAMEBUFFER, "pick target");
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(framebuffer));
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gpuResources().get(ids));
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gpuResources().get(depth));
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::PICKING::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (int i = 0; i < PICK_READBACKS; i++)
+        {
+            buffers[i] = gpuResources().create(GPU_BUFFER, "pick readback");
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, gpuResources().get(buffers[i]));
+            glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+            gpuResources().setBytes(buffers[i], sizeof(GLuint));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+};
+
+#endif
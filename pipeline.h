@@ -0,0 +1,115 @@
+//
+//  pipeline.h
+//  3D Object Drawing
+//
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+// Two-stage frame pipeline between a producer (simulation) thread and the GL thread, with
+// one snapshot of the frame state per stage. The producer fills back() with frame N+1 while
+// the GL thread draws current(), frame N; publish() hands the snapshot over and acquire()
+// swaps it in. The producer never gets more than one frame ahead, so the GL thread always
+// draws the newest finished state and neither side copies it.
+// With Lockstep set the producer also waits for finish(), the GL thread being done with its
+// frame: the two stop overlapping, and the state (input) is sampled a frame later and so is a
+// frame fresher when it reaches the screen.
+template <class State>
+class FramePipeline
+{
+public:
+    bool Lockstep;
+
+    // every argument is passed to the constructor of both snapshots
+    template <class... Args>
+    explicit FramePipeline(Args&... args) : Lockstep(false), front(0), ready(false), drawing(false), stopped(false)
+    {
+        slots[0].reset(new State(args...));
+        slots[1].reset(new State(args...));
+    }
+
+    // producer: waits until the GL thread took the last published frame; false once stopped
+    bool beginWrite()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return (!ready && !(Lockstep && drawing)) || stopped; });
+        return !stopped;
+    }
+
+    // producer: the snapshot being filled; only valid between beginWrite() and publish()
+    State& back()
+    {
+        return *slots[1 - front];
+    }
+
+    void publish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready = true;
+        }
+        changed.notify_all();
+    }
+
+    // GL thread: waits for the next published frame and makes it current(); false once stopped
+    bool acquire()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return ready || stopped; });
+            if (!ready)
+                return false;
+            front = 1 - front;
+            ready = false;
+            drawing = true;
+        }
+        changed.notify_all();
+        return true;
+    }
+
+    // GL thread: done with current(), for Lockstep
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            drawing = false;
+        }
+        changed.notify_all();
+    }
+
+    // GL thread: the frame being drawn
+    State& current()
+    {
+        return *slots[front];
+    }
+
+    // both snapshots, for releasing their GL objects after the producer stopped
+    State& slot(int i)
+    {
+        return *slots[i];
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        changed.notify_all();
+    }
+
+private:
+    std::unique_ptr<State> slots[2];
+    int front;
+    bool ready;
+    bool drawing;
+    bool stopped;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,339 @@
+//
+//  portals.h
+//  3D Object Drawing
+//
+
+#ifndef PORTALS_H
+#define PORTALS_H
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "instance_batch.h"
+#include "frame_arena.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// Default portal values
+const std::string PORTALS_PATH = "scenes/room.portals";
+const int PORTAL_MAX_DEPTH = 8;            // portals followed in a row before giving up
+const float PORTAL_GAP_STEP = 0.1f;        // sample spacing when finding a doorway in the walls
+const float PORTAL_CELL_MARGIN = 0.3f;     // boxes this far outside a cell still count as in it (walls, door frames)
+
+
+// An axis-aligned room
+struct PortalCell
+{
+    std::string name;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    std::vector<int> portals;
+};
+
+// A convex opening between two cells; corners go around the quad
+struct Portal
+{
+    int cells[2];
+    glm::vec3 corners[4];
+    bool derived;       // corners come from the wall gap on the shared face
+    bool open;          // false until a derived portal found its gap
+};
+
+// The cells seen this frame, each with the frustum narrowed to the portals it was seen
+// through. A box is visible when it sits in one of the cells and inside that cell's frustum.
+// Outside every cell (or without a graph) it is the plain view frustum.
+struct PortalVisibility
+{
+    struct View
+    {
+        int cell;
+        Frustum frustum;
+    };
+
+    std::vector<View> Views;
+    std::vector<glm::vec3> CellMin, CellMax;    // per view, grown by PORTAL_CELL_MARGIN
+    Frustum Full;
+    bool Enabled = false;
+
+    bool intersects(const glm::vec3& center, const glm::vec3& halfSize) const
+    {
+        if (!Enabled)
+            return Full.intersects(center, halfSize);
+        for (size_t i = 0; i < Views.size(); i++)
+        {
+            if (glm::any(glm::lessThan(center + halfSize, CellMin[i])) || glm::any(glm::greaterThan(center - halfSize, CellMax[i])))
+                continue;
+            if (Views[i].frustum.intersects(center, halfSize))
+                return true;
+        }
+        return false;
+    }
+};
+
+// Cell/portal graph of an interior. Each frame the view frustum is clipped recursively
+// through the portals of the camera's cell, so only the rooms seen through an opening are
+// visited and everything in the other rooms is culled without testing their contents
+// against the full frustum.
+//
+// The graph is a text file:
+//     cell <name> <min x y z> <max x y z>
+//     portal <cell> <cell> <corner x y z> x4      (authored opening)
+//     portal <cell> <cell> auto                   (opening found by derive())
+class PortalGraph
+{
+public:
+    std::vector<PortalCell> Cells;
+    std::vector<Portal> Portals;
+
+    bool load(const std::string& path)
+    {
+        Cells.clear();
+        Portals.clear();
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::PORTALS::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword) || keyword[0] == '#')
+                continue;
+
+            bool ok = true;
+            if (keyword == "cell")
+            {
+                PortalCell cell;
+                ok = (bool)(words >> cell.name) && readVec3(words, cell.boundsMin) && readVec3(words, cell.boundsMax) && find(cell.name) < 0;
+                if (ok)
+                    Cells.push_back(cell);
+            }
+            else if (keyword == "portal")
+            {
+                Portal portal;
+                std::string a, b, corner;
+                ok = (bool)(words >> a >> b);
+                portal.cells[0] = find(a);
+                portal.cells[1] = find(b);
+                ok = ok && portal.cells[0] >= 0 && portal.cells[1] >= 0 && portal.cells[0] != portal.cells[1];
+                std::streampos corners = words.tellg();
+                portal.derived = ok && (words >> corner) && corner == "auto";
+                portal.open = !portal.derived;
+                words.clear();
+                words.seekg(corners);
+                for (int i = 0; ok && !portal.derived && i < 4; i++)
+                    ok = readVec3(words, portal.corners[i]);
+                if (ok)
+                {
+                    Cells[portal.cells[0]].portals.push_back((int)Portals.size());
+                    Cells[portal.cells[1]].portals.push_back((int)Portals.size());
+                    Portals.push_back(portal);
+                }
+            }
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                std::cout << "ERROR::PORTALS::SYNTAX: " << path << ":" << lineNumber << ": " << line << std::endl;
+                Cells.clear();
+                Portals.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Finds the "auto" portals: the part of the face two cells share that no wall box covers.
+    // The face is sampled every PORTAL_GAP_STEP and the portal is the rectangle around the
+    // free samples, so a doorway cut into one wall gives back the door opening.
+    void derive(const std::vector<InstanceBounds>& walls)
+    {
+        for (size_t p = 0; p < Portals.size(); p++)
+        {
+            Portal& portal = Portals[p];
+            if (!portal.derived)
+                continue;
+            const PortalCell& a = Cells[portal.cells[0]];
+            const PortalCell& b = Cells[portal.cells[1]];
+
+            // the axis the cells touch on, and the rectangle they share across it
+            int axis = -1;
+            float plane = 0.0f;
+            for (int k = 0; k < 3 && axis < 0; k++)
+            {
+                if (std::abs(a.boundsMax[k] - b.boundsMin[k]) < PORTAL_GAP_STEP)
+                    axis = k, plane = 0.5f * (a.boundsMax[k] + b.boundsMin[k]);
+                else if (std::abs(b.boundsMax[k] - a.boundsMin[k]) < PORTAL_GAP_STEP)
+                    axis = k, plane = 0.5f * (b.boundsMax[k] + a.boundsMin[k]);
+            }
+            int u = (axis + 1) % 3, v = (axis + 2) % 3;
+            glm::vec2 faceMin, faceMax;
+            if (axis >= 0)
+            {
+                faceMin = glm::vec2(std::max(a.boundsMin[u], b.boundsMin[u]), std::max(a.boundsMin[v], b.boundsMin[v]));
+                faceMax = glm::vec2(std::min(a.boundsMax[u], b.boundsMax[u]), std::min(a.boundsMax[v], b.boundsMax[v]));
+            }
+            if (axis < 0 || faceMin.x >= faceMax.x || faceMin.y >= faceMax.y)
+            {
+                std::cout << "ERROR::PORTALS::CELLS_NOT_ADJACENT: " << a.name << " " << b.name << std::endl;
+                continue;
+            }
+
+            // walls crossing the shared plane
+            std::vector<const InstanceBounds*> crossing;
+            for (size_t i = 0; i < walls.size(); i++)
+                if (std::abs(walls[i].center[axis] - plane) <= walls[i].halfSize[axis])
+                    crossing.push_back(&walls[i]);
+
+            glm::vec2 gapMin(1e30f), gapMax(-1e30f);
+            for (float s = faceMin.x + 0.5f * PORTAL_GAP_STEP; s < faceMax.x; s += PORTAL_GAP_STEP)
+                for (float t = faceMin.y + 0.5f * PORTAL_GAP_STEP; t < faceMax.y; t += PORTAL_GAP_STEP)
+                {
+                    bool covered = false;
+                    for (size_t i = 0; i < crossing.size() && !covered; i++)
+                        covered = std::abs(crossing[i]->center[u] - s) <= crossing[i]->halfSize[u] &&
+                            std::abs(crossing[i]->center[v] - t) <= crossing[i]->halfSize[v];
+                    if (!covered)
+                    {
+                        gapMin = glm::min(gapMin, glm::vec2(s, t));
+                        gapMax = glm::max(gapMax, glm::vec2(s, t));
+                    }
+                }
+            if (gapMin.x > gapMax.x)
+            {
+                std::cout << "ERROR::PORTALS::NO_GAP: " << a.name << " " << b.name << std::endl;
+                continue;
+            }
+            gapMin = glm::max(gapMin - 0.5f * PORTAL_GAP_STEP, faceMin);
+            gapMax = glm::min(gapMax + 0.5f * PORTAL_GAP_STEP, faceMax);
+
+            glm::vec2 quad[4] = { gapMin, glm::vec2(gapMax.x, gapMin.y), gapMax, glm::vec2(gapMin.x, gapMax.y) };
+            for (int i = 0; i < 4; i++)
+            {
+                portal.corners[i][axis] = plane;
+                portal.corners[i][u] = quad[i].x;
+                portal.corners[i][v] = quad[i].y;
+            }
+            portal.open = true;
+        }
+    }
+
+    int find(const std::string& name) const
+    {
+        for (size_t i = 0; i < Cells.size(); i++)
+            if (Cells[i].name == name)
+                return (int)i;
+        return -1;
+    }
+
+    // cell the point is in, -1 if none
+    int cellAt(const glm::vec3& position) const
+    {
+        for (size_t i = 0; i < Cells.size(); i++)
+            if (glm::all(glm::greaterThanEqual(position, Cells[i].boundsMin)) && glm::all(glm::lessThanEqual(position, Cells[i].boundsMax)))
+                return (int)i;
+        return -1;
+    }
+
+    // frustum is the one of viewProjection, usually the camera's cached CameraBase::GetFrustum()
+    void traverse(const glm::vec3& eye, const glm::mat4& viewProjection, const Frustum& frustum, PortalVisibility& visibility) const
+    {
+        visibility.Views.clear();
+        visibility.CellMin.clear();
+        visibility.CellMax.clear();
+        visibility.Full = frustum;
+        int start = cellAt(eye);
+        visibility.Enabled = start >= 0;
+        if (start < 0)
+            return;
+        FrameVector<int> path(frameArena());
+        path.reserve(PORTAL_MAX_DEPTH);
+        visit(start, viewProjection, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), path, visibility);
+    }
+
+private:
+    static bool readVec3(std::istream& in, glm::vec3& v)
+    {
+        return (bool)(in >> v.x >> v.y >> v.z);
+    }
+
+    void visit(int cell, const glm::mat4& viewProjection, const glm::vec4& rect, FrameVector<int>& path, PortalVisibility& visibility) const
+    {
+        PortalVisibility::View view;
+        view.cell = cell;
+        view.frustum.set(viewProjection, rect);
+        visibility.Views.push_back(view);
+        visibility.CellMin.push_back(Cells[cell].boundsMin - PORTAL_CELL_MARGIN);
+        visibility.CellMax.push_back(Cells[cell].boundsMax + PORTAL_CELL_MARGIN);
+        if ((int)path.size() >= PORTAL_MAX_DEPTH)
+            return;
+
+        path.push_back(cell);
+        const std::vector<int>& portals = Cells[cell].portals;
+        for (size_t i = 0; i < portals.size(); i++)
+        {
+            const Portal& portal = Portals[portals[i]];
+            int next = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+            if (!portal.open || std::find(path.begin(), path.end(), next) != path.end())
+                continue;
+            glm::vec4 portalRect;
+            if (!screenRect(portal, viewProjection, portalRect))
+                continue;
+            glm::vec4 clipped(std::max(rect.x, portalRect.x), std::max(rect.y, portalRect.y),
+                std::min(rect.z, portalRect.z), std::min(rect.w, portalRect.w));
+            if (clipped.x < clipped.z && clipped.y < clipped.w)
+                visit(next, viewProjection, clipped, path, visibility);
+        }
+        path.pop_back();
+    }
+
+    // NDC rectangle around the portal; the quad is clipped to the front of the eye first, so
+    // a doorway the camera stands in opens up to the whole screen instead of flipping
+    static bool screenRect(const Portal& portal, const glm::mat4& viewProjection, glm::vec4& rect)
+    {
+        const float nearW = 1e-4f;
+        glm::vec4 clip[4];
+        for (int i = 0; i < 4; i++)
+            clip[i] = viewProjection * glm::vec4(portal.corners[i], 1.0f);
+
+        glm::vec2 low(1e30f), high(-1e30f);
+        int kept = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 4];
+            if (a.w > nearW)
+            {
+                glm::vec2 p = glm::vec2(a.x, a.y) / a.w;
+                low = glm::min(low, p);
+                high = glm::max(high, p);
+                kept++;
+            }
+            if ((a.w > nearW) != (b.w > nearW))
+            {
+                glm::vec4 c = a + (b - a) * ((nearW - a.w) / (b.w - a.w));
+                glm::vec2 p = glm::vec2(c.x, c.y) / c.w;
+                low = glm::min(low, p);
+                high = glm::max(high, p);
+                kept++;
+            }
+        }
+        if (kept == 0)
+            return false;
+        rect = glm::vec4(glm::max(low, glm::vec2(-1.0f)), glm::min(high, glm::vec2(1.0f)));
+        return rect.x < rect.z && rect.y < rect.w;
+    }
+};
+
+#endif
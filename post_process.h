@@ -0,0 +1,147 @@
+//
+//  post_process.h
+//  3D Object Drawing
+//
+
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "gpu_resources.h"
+
+#include <string>
+
+// Default post-processing values
+const float POST_EXPOSURE = 1.0f;
+const float POST_BLOOM_THRESHOLD = 1.0f;        // HDR brightness where bloom starts
+
+// features of the composite pass, each a #define of composite.fs
+enum PostFeature
+{
+    POST_TONEMAP = 1,
+    POST_FXAA = 2,
+    POST_BLOOM = 4,
+    POST_VARIANTS = 8           // every combination of the above
+};
+
+
+// Tonemapping, FXAA and bloom in one full-screen pass from the main pass color to the window,
+// instead of one pass per effect: on a software GL every full-screen pass costs about as much as
+// the scene itself. The composite also scales the render resolution up to the window, which
+// SceneTarget::end() does otherwise. Each combination of Features is its own program, compiled
+// from composite.vs/.fs with the features defined the first time it is used, so a disabled
+// effect costs nothing, not even a branch. Bloom reads the mips of the scene color, generated
+// before the pass; they are the only extra GPU work.
+// GL thread only.
+class PostProcess
+{
+public:
+    int Features;               // PostFeature bits; 0 leaves the window to SceneTarget::end()
+    float Exposure;
+    float BloomStrength;
+    float BloomThreshold;
+
+    PostProcess(const std::string& vertexPath, const std::string& fragmentPath)
+        : Features(0), Exposure(POST_EXPOSURE), BloomStrength(0.0f), BloomThreshold(POST_BLOOM_THRESHOLD),
+        vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+        for (int i = 0; i < POST_VARIANTS; i++)
+            variants[i].program = NULL;
+    }
+
+    // tonemapping and bloom need the scene in HDR, GL_RGBA16F instead of RGBA8
+    GLenum colorFormat() const
+    {
+        return (Features & (POST_TONEMAP | POST_BLOOM)) ? GL_RGBA16F : GL_RGBA8;
+    }
+
+    // draws the color texture of the main pass (width x height) over the whole window and leaves the window bound
+    void apply(unsigned int color, int width, int height, int windowWidth, int windowHeight)
+    {
+        const Variant& variant = select(Features);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, color);
+        if (Features & POST_BLOOM)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        gpuResources().countStateChange();
+        glViewport(0, 0, windowWidth, windowHeight);
+        glDisable(GL_DEPTH_TEST);
+        variant.program->use();
+        glUniform1i(variant.sceneColor, 0);
+        glUniform2f(variant.texelSize, 1.0f / width, 1.0f / height);
+        glUniform1f(variant.exposure, Exposure);
+        glUniform1f(variant.bloomStrength, BloomStrength);
+        glUniform1f(variant.bloomThreshold, BloomThreshold);
+        if (gpuResources().get(emptyArray) == 0)
+            emptyArray = gpuResources().create(GPU_VERTEX_ARRAY, "composite");
+        glBindVertexArray(gpuResources().get(emptyArray));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        gpuResources().countStateChange();
+        gpuResources().countDraw();
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void release()
+    {
+        for (int i = 0; i < POST_VARIANTS; i++)
+        {
+            if (variants[i].program != NULL)
+            {
+                glDeleteProgram(variants[i].program->ID);
+                delete variants[i].program;
+            }
+            variants[i].program = NULL;
+        }
+        gpuResources().destroy(emptyArray);
+    }
+
+private:
+    // a compiled combination of features, with its uniforms looked up once
+    struct Variant
+    {
+        Shader* program;
+        GLint sceneColor;
+        GLint texelSize;
+        GLint exposure;
+        GLint bloomStrength;
+        GLint bloomThreshold;
+    };
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    Variant variants[POST_VARIANTS];
+    GpuHandle emptyArray;       // the full-screen triangle is made in the vertex shader, but core GL still wants a vertex array bound
+
+    const Variant& select(int features)
+    {
+        Variant& variant = variants[features];
+        if (variant.program == NULL)
+        {
+            std::string defines;
+            if (features & POST_TONEMAP)
+                defines += "#define TONEMAP\n";
+            if (features & POST_FXAA)
+                defines += "#define FXAA\n";
+            if (features & POST_BLOOM)
+                defines += "#define BLOOM\n";
+            variant.program = new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines);
+            GLuint id = variant.program->ID;
+            variant.sceneColor = glGetUniformLocation(id, "sceneColor");
+            variant.texelSize = glGetUniformLocation(id, "texelSize");
+            variant.exposure = glGetUniformLocation(id, "exposure");
+            variant.bloomStrength = glGetUniformLocation(id, "bloomStrength");
+            variant.bloomThreshold = glGetUniformLocation(id, "bloomThreshold");
+        }
+        return variant;
+    }
+};
+
+#endif
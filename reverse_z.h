@@ -0,0 +1,65 @@
+//
+//  reverse_z.h
+//  3D Object Drawing
+//
+
+#ifndef REVERSE_Z_H
+#define REVERSE_Z_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+#ifndef GL_LOWER_LEFT
+#define GL_LOWER_LEFT 0x8CA1
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+#define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#endif
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+
+// glClipControl is GL 4.5 or ARB_clip_control, so it is fetched by hand like glMultiDrawElementsIndirect
+typedef void (APIENTRYP ClipControlProc)(GLenum origin, GLenum depth);
+
+inline ClipControlProc& clipControl()
+{
+    static ClipControlProc proc = NULL;
+    return proc;
+}
+
+// call once after gladLoadGLLoader; returns whether reverse-Z can be used
+inline bool loadClipControl(GLADloadproc load)
+{
+    GLint major = 0, minor = 0, extensions = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 5);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions && !supported; i++)
+        supported = strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_clip_control") == 0;
+    clipControl() = supported ? (ClipControlProc)load("glClipControl") : NULL;
+    return clipControl() != NULL;
+}
+
+// Reverse-Z state for the main pass: depth mapped to [0, 1], cleared to 0 and tested with
+// GL_GREATER. The pass has to go into a GL_DEPTH_COMPONENT32F buffer (see SceneTarget): float
+// depth is densest near 0, which reverse-Z puts at the far end, so precision stays about even
+// over the whole range instead of being spent on the first meter. The shadow passes keep the
+// usual [-1, 1] depth and GL_LESS, so endReverseZ() puts that back.
+inline void beginReverseZ()
+{
+    clipControl()(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glDepthFunc(GL_GREATER);
+    glClearDepth(0.0);
+}
+
+inline void endReverseZ()
+{
+    clipControl()(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+    glDepthFunc(GL_LESS);
+    glClearDepth(1.0);
+}
+
+#endif
@@ -0,0 +1,510 @@
+//
+//  scene.h
+//  3D Object Drawing
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frame_arena.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+// Default scene values
+const std::string SCENE_PATH = "scenes/room.scene";
+const int SCENE_PLACEMENTS_PER_CHUNK = 64;
+const uint32_t SCENE_BINARY_VERSION = 2;       // 2 added box opacity
+
+
+// One box of a prefab: a mesh with its own transform and look
+struct SceneBox
+{
+    std::string mesh;           // "cube" or "bed"
+    glm::mat4 transform;
+    glm::vec3 color;
+    std::string surface;        // atlas region, empty for flat color
+    float textureScale;
+    float opacity;              // 1 = opaque; glass and the like are less
+};
+
+struct ScenePrefab
+{
+    std::string name;
+    std::vector<SceneBox> boxes;
+};
+
+// A prefab put into the world. Placements with an animation binding are rebuilt every
+// frame as world = transform * animation * box.transform, the others are static.
+struct ScenePlacement
+{
+    std::string prefab;
+    glm::mat4 transform;
+    std::string animation;
+    unsigned int id = 0;        // set by Scene::merge: 1, 2, ... in load order, for picking
+};
+
+// What one chunk of a scene file turned into
+struct SceneChunk
+{
+    std::vector<ScenePrefab> prefabs;
+    std::vector<ScenePlacement> placements;
+};
+
+// translate * rotateX * rotateY * rotateZ * scale, angles in degrees (same order as transform() in main.cpp)
+inline glm::mat4 sceneTransform(glm::vec3 position, glm::vec3 rotation, glm::vec3 scale)
+{
+    glm::mat4 identityMatrix = glm::mat4(1.0f);
+    glm::mat4 model = glm::translate(identityMatrix, position);
+    model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::scale(model, scale);
+}
+
+
+// Scene files come in two forms with the same content.
+//
+// Text (.scene), for editing; one statement per line, '#' starts a comment:
+//     prefab <name>
+//         box <mesh> [pos x y z] [rot x y z] [scale x y z] [color r g b] [surface <region> <scale>] [opacity a]
+//     end
+//     place <prefab> [pos x y z] [rot x y z] [scale x y z] [animate <binding>]
+// A prefab has to be defined before it is placed.
+//
+// Binary (.sceneb), for streaming; little endian, "SCNB" + u32 version, then chunks of
+// char[4] type + u32 payload size:
+//     PRFB  str name, u32 count, count x (str mesh, f32[16] transform, f32[3] color, str surface, f32 scale, f32 opacity)
+//     PLAC  u32 count, count x (str prefab, f32[16] transform, str animation)
+//     END   empty
+// with str = u16 length + bytes. Every chunk is usable on its own, so a loader can hand
+// chunks to the renderer while the rest of the file is still being read. Version 1 files,
+// from before opacity, still load, with every box opaque.
+class SceneFile
+{
+public:
+    typedef std::function<void(SceneChunk&)> ChunkHandler;
+
+    // parses either form (told apart by the magic), calling onChunk as chunks complete
+    static bool read(const std::string& path, const ChunkHandler& onChunk)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::SCENE::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        char magic[4] = { 0, 0, 0, 0 };
+        file.read(magic, 4);
+        file.clear();
+        file.seekg(0);
+        if (memcmp(magic, "SCNB", 4) == 0)
+            return readBinary(file, path, onChunk);
+        return readText(file, path, onChunk);
+    }
+
+    static bool readText(std::istream& in, const std::string& path, const ChunkHandler& onChunk)
+    {
+        std::map<std::string, bool> defined;
+        SceneChunk placements;
+        ScenePrefab prefab;
+        bool inPrefab = false;
+        std::string line;
+        for (int lineNumber = 1; std::getline(in, line); lineNumber++)
+        {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword))
+                continue;
+
+            bool ok = true;
+            if (keyword == "prefab" && !inPrefab)
+            {
+                prefab = ScenePrefab();
+                ok = (bool)(words >> prefab.name);
+                inPrefab = true;
+            }
+            else if (keyword == "end" && inPrefab)
+            {
+                defined[prefab.name] = true;
+                SceneChunk chunk;
+                chunk.prefabs.push_back(prefab);
+                onChunk(chunk);
+                inPrefab = false;
+            }
+            else if (keyword == "box" && inPrefab)
+            {
+                SceneBox box;
+                glm::vec3 position(0.0f), rotation(0.0f), scale(1.0f);
+                box.color = glm::vec3(1.0f);
+                box.textureScale = 1.0f;
+                box.opacity = 1.0f;
+                ok = (bool)(words >> box.mesh);
+                std::string key;
+                while (ok && words >> key)
+                {
+                    if (key == "pos") ok = readVec3(words, position);
+                    else if (key == "rot") ok = readVec3(words, rotation);
+                    else if (key == "scale") ok = readVec3(words, scale);
+                    else if (key == "color") ok = readVec3(words, box.color);
+                    else if (key == "surface") ok = (bool)(words >> box.surface >> box.textureScale);
+                    else if (key == "opacity") ok = (bool)(words >> box.opacity) && box.opacity >= 0.0f && box.opacity <= 1.0f;
+                    else ok = false;
+                }
+                box.transform = sceneTransform(position, rotation, scale);
+                prefab.boxes.push_back(box);
+            }
+            else if (keyword == "place" && !inPrefab)
+            {
+                ScenePlacement placement;
+                glm::vec3 position(0.0f), rotation(0.0f), scale(1.0f);
+                ok = (bool)(words >> placement.prefab) && defined.count(placement.prefab) > 0;
+                std::string key;
+                while (ok && words >> key)
+                {
+                    if (key == "pos") ok = readVec3(words, position);
+                    else if (key == "rot") ok = readVec3(words, rotation);
+                    else if (key == "scale") ok = readVec3(words, scale);
+                    else if (key == "animate") ok = (bool)(words >> placement.animation);
+                    else ok = false;
+                }
+                placement.transform = sceneTransform(position, rotation, scale);
+                placements.placements.push_back(placement);
+                if ((int)placements.placements.size() == SCENE_PLACEMENTS_PER_CHUNK)
+                {
+                    onChunk(placements);
+                    placements = SceneChunk();
+                }
+            }
+            else
+                ok = false;
+
+            if (!ok)
+            {
+                std::cout << "ERROR::SCENE::SYNTAX: " << path << ":" << lineNumber << ": " << line << std::endl;
+                return false;
+            }
+        }
+        if (!placements.placements.empty())
+            onChunk(placements);
+        return !inPrefab;
+    }
+
+    static bool readBinary(std::istream& in, const std::string& path, const ChunkHandler& onChunk)
+    {
+        char magic[4];
+        uint32_t version = 0;
+        in.read(magic, 4);
+        in.read((char*)&version, 4);
+        if (!in || version < 1 || version > SCENE_BINARY_VERSION)
+        {
+            std::cout << "ERROR::SCENE::UNSUPPORTED_VERSION: " << path << std::endl;
+            return false;
+        }
+        // chunk sizes come from the file; one larger than what is left is corrupt, not allocated
+        std::streamoff start = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::streamoff end = in.tellg();
+        in.seekg(start);
+        while (true)
+        {
+            char type[4];
+            uint32_t size = 0;
+            in.read(type, 4);
+            in.read((char*)&size, 4);
+            if (!in)
+                break;
+            if (memcmp(type, "END ", 4) == 0)
+                return true;
+            if ((std::streamoff)size > end - in.tellg())
+                break;
+            std::vector<char> payload(size);
+            if (size > 0 && !in.read(&payload[0], size))
+                break;
+            Reader reader(payload);
+            SceneChunk chunk;
+            if (memcmp(type, "PRFB", 4) == 0)
+            {
+                ScenePrefab prefab;
+                prefab.name = reader.str();
+                uint32_t count = reader.u32();
+                for (uint32_t i = 0; i < count && reader.ok; i++)
+                {
+                    SceneBox box;
+                    box.mesh = reader.str();
+                    box.transform = reader.mat4();
+                    box.color = reader.vec3();
+                    box.surface = reader.str();
+                    box.textureScale = reader.f32();
+                    box.opacity = version >= 2 ? reader.f32() : 1.0f;
+                    prefab.boxes.push_back(box);
+                }
+                chunk.prefabs.push_back(prefab);
+            }
+            else if (memcmp(type, "PLAC", 4) == 0)
+            {
+                uint32_t count = reader.u32();
+                for (uint32_t i = 0; i < count && reader.ok; i++)
+                {
+                    ScenePlacement placement;
+                    placement.prefab = reader.str();
+                    placement.transform = reader.mat4();
+                    placement.animation = reader.str();
+                    chunk.placements.push_back(placement);
+                }
+            }
+            else
+                continue;   // unknown chunks are skipped so newer files still load
+            if (!reader.ok)
+                break;
+            onChunk(chunk);
+        }
+        std::cout << "ERROR::SCENE::TRUNCATED: " << path << std::endl;
+        return false;
+    }
+
+    static bool writeBinary(const std::string& path, const std::vector<SceneChunk>& chunks)
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+        file.write("SCNB", 4);
+        uint32_t version = SCENE_BINARY_VERSION;
+        file.write((const char*)&version, 4);
+        for (size_t c = 0; c < chunks.size(); c++)
+        {
+            for (size_t p = 0; p < chunks[c].prefabs.size(); p++)
+            {
+                const ScenePrefab& prefab = chunks[c].prefabs[p];
+                Writer writer;
+                writer.str(prefab.name);
+                writer.u32((uint32_t)prefab.boxes.size());
+                for (size_t i = 0; i < prefab.boxes.size(); i++)
+                {
+                    const SceneBox& box = prefab.boxes[i];
+                    writer.str(box.mesh);
+                    writer.mat4(box.transform);
+                    writer.vec3(box.color);
+                    writer.str(box.surface);
+                    writer.f32(box.textureScale);
+                    writer.f32(box.opacity);
+                }
+                writeChunk(file, "PRFB", writer.data);
+            }
+            const std::vector<ScenePlacement>& placements = chunks[c].placements;
+            for (size_t first = 0; first < placements.size(); first += SCENE_PLACEMENTS_PER_CHUNK)
+            {
+                size_t last = std::min(placements.size(), first + SCENE_PLACEMENTS_PER_CHUNK);
+                Writer writer;
+                writer.u32((uint32_t)(last - first));
+                for (size_t i = first; i < last; i++)
+                {
+                    writer.str(placements[i].prefab);
+                    writer.mat4(placements[i].transform);
+                    writer.str(placements[i].animation);
+                }
+                writeChunk(file, "PLAC", writer.data);
+            }
+        }
+        writeChunk(file, "END ", std::vector<char>());
+        return file.good();
+    }
+
+    // build step: text scene in, binary scene out
+    static bool convert(const std::string& input, const std::string& output)
+    {
+        std::vector<SceneChunk> chunks;
+        if (!read(input, [&chunks](SceneChunk& chunk) { chunks.push_back(chunk); }))
+            return false;
+        return writeBinary(output, chunks);
+    }
+
+private:
+    static bool readVec3(std::istream& in, glm::vec3& v)
+    {
+        return (bool)(in >> v.x >> v.y >> v.z);
+    }
+
+    static void writeChunk(std::ofstream& file, const char* type, const std::vector<char>& payload)
+    {
+        uint32_t size = (uint32_t)payload.size();
+        file.write(type, 4);
+        file.write((const char*)&size, 4);
+        if (size > 0)
+            file.write(&payload[0], size);
+    }
+
+    struct Reader
+    {
+        const std::vector<char>& data;
+        size_t offset;
+        bool ok;
+
+        Reader(const std::vector<char>& payload) : data(payload), offset(0), ok(true) {}
+
+        void bytes(void* out, size_t size)
+        {
+            if (offset + size > data.size())
+            {
+                ok = false;
+                memset(out, 0, size);
+                return;
+            }
+            memcpy(out, &data[offset], size);
+            offset += size;
+        }
+        uint32_t u32() { uint32_t v; bytes(&v, 4); return v; }
+        float f32() { float v; bytes(&v, 4); return v; }
+        glm::vec3 vec3() { glm::vec3 v; v.x = f32(); v.y = f32(); v.z = f32(); return v; }
+        glm::mat4 mat4()
+        {
+            glm::mat4 m;
+            for (int i = 0; i < 4; i++)
+                for (int j = 0; j < 4; j++)
+                    m[i][j] = f32();
+            return m;
+        }
+        std::string str()
+        {
+            uint16_t length = 0;
+            bytes(&length, 2);
+            if (!ok || offset + length > data.size())
+            {
+                ok = false;
+                return std::string();
+            }
+            std::string s(&data[offset], length);
+            offset += length;
+            return s;
+        }
+    };
+
+    struct Writer
+    {
+        std::vector<char> data;
+
+        void bytes(const void* in, size_t size) { data.insert(data.end(), (const char*)in, (const char*)in + size); }
+        void u32(uint32_t v) { bytes(&v, 4); }
+        void f32(float v) { bytes(&v, 4); }
+        void vec3(const glm::vec3& v) { f32(v.x); f32(v.y); f32(v.z); }
+        void mat4(const glm::mat4& m)
+        {
+            for (int i = 0; i < 4; i++)
+                for (int j = 0; j < 4; j++)
+                    f32(m[i][j]);
+        }
+        void str(const std::string& s)
+        {
+            uint16_t length = (uint16_t)s.size();
+            bytes(&length, 2);
+            bytes(s.data(), length);
+        }
+    };
+};
+
+
+// Parses scene files on a background thread. The render loop picks up finished chunks
+// with poll() once per frame, so a large floorplan fills in over several frames instead
+// of blocking startup.
+class SceneLoader
+{
+public:
+    SceneLoader() : loading(0) {}
+
+    ~SceneLoader()
+    {
+        stop();
+    }
+
+    void load(const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loading++;
+        }
+        threads.push_back(std::thread([this, path]() {
+            HeapScope heapScope(HEAP_SCENE);
+            SceneFile::read(path, [this](SceneChunk& chunk) {
+                std::lock_guard<std::mutex> lock(mutex);
+                results.push_back(chunk);
+            });
+            std::lock_guard<std::mutex> lock(mutex);
+            loading--;
+        }));
+    }
+
+    // moves the chunks finished so far into chunks; returns false once everything has been handed out
+    bool poll(std::vector<SceneChunk>& chunks)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks.insert(chunks.end(), results.begin(), results.end());
+        results.clear();
+        return loading > 0 || !chunks.empty();
+    }
+
+    void stop()
+    {
+        for (size_t i = 0; i < threads.size(); i++)
+            if (threads[i].joinable())
+                threads[i].join();
+        threads.clear();
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::deque<SceneChunk> results;
+    int loading;
+};
+
+
+// Everything loaded so far: prefabs by name and the animated placements, which have to
+// be re-instanced every frame. Static placements are handed straight to the caller.
+class Scene
+{
+public:
+    std::map<std::string, ScenePrefab> Prefabs;
+    std::vector<ScenePlacement> Animated;
+    std::vector<std::string> PlacementPrefabs;      // prefab of each placement id; [0] is nothing
+
+    Scene() : PlacementPrefabs(1) {}
+
+    // takes in a loaded chunk; appends its static placements to newStatic
+    void merge(const SceneChunk& chunk, std::vector<ScenePlacement>& newStatic)
+    {
+        for (size_t i = 0; i < chunk.prefabs.size(); i++)
+            Prefabs[chunk.prefabs[i].name] = chunk.prefabs[i];
+        for (size_t i = 0; i < chunk.placements.size(); i++)
+        {
+            ScenePlacement placement = chunk.placements[i];
+            if (Prefabs.count(placement.prefab) == 0)
+            {
+                std::cout << "ERROR::SCENE::UNKNOWN_PREFAB: " << placement.prefab << std::endl;
+                continue;
+            }
+            placement.id = (unsigned int)PlacementPrefabs.size();
+            PlacementPrefabs.push_back(placement.prefab);
+            if (placement.animation.empty())
+                newStatic.push_back(placement);
+            else
+                Animated.push_back(placement);
+        }
+    }
+};
+
+#endif
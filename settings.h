@@ -0,0 +1,294 @@
+//
+//  settings.h
+//  3D Object Drawing
+//
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "camera.h"
+#include "scene.h"
+#include "portals.h"
+#include "animation.h"
+#include "post_process.h"
+#include "telemetry.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+// Default settings values
+const std::string SETTINGS_PATH = "settings.cfg";   // read at startup when it exists
+const int SETTINGS_WIDTH = 800;
+const int SETTINGS_HEIGHT = 600;
+const float SETTINGS_NEAR = 0.1f;
+const float SETTINGS_FAR = 100.0f;
+
+
+// What a run is configured with: the built-in defaults, then a settings file, then the command
+// line, each overriding the one before, so one binary covers the whole benchmark matrix:
+//     3D --config lowend.cfg --msaa 4 --vsync off --frames 1000
+// Settings file: one "<name> <value>" per line, '#' starts a comment. The names are the
+// command line flags without the dashes; switches take on/off in the file and nothing on the
+// command line.
+//     width, height <pixels>           window size (and the --software image size)
+//     vsync on|off|adaptive|driver     swap interval (see setVsync() in frame_pacing.h); on by
+//                                      default, driver only when asked for, since its default
+//                                      differs between machines
+//     fps-limit <frames per second>    frame limiter, 0 for none
+//     latency normal|low               low: the CPU waits for each frame on the GPU and the
+//                                      simulation for the GL thread before taking input
+//     latency-log <file>               input-to-photon latency of every frame with input
+//     msaa <samples>                   multisampling of the main pass, 0 for none
+//     tonemap on|off                   main pass in HDR, tonemapped to the window (see post_process.h);
+//                                      off by default, ACES darkens the white clear color and lit walls
+//     exposure <factor>                HDR color multiplier before tonemapping
+//     aa fxaa|off                      antialiasing in the composite pass
+//     bloom <strength>                 glow around HDR color over 1, 0 for none
+//     headless on|off                  hidden window
+//     scene <file>                     .scene or .sceneb; also sets portals and animation to
+//                                      the .portals and .anim files next to it
+//     portals <file>, animation <file>
+//     frames <count>                   exit after that many frames and print the frame time, 0 runs on
+//     threads <count>                  texture streaming and software rasterizer workers, 0 for one per core
+//     near, far <distance>             clip planes of the camera
+//     fov <degrees>                    starting vertical field of view
+//     speed <units per second>         camera movement
+//     sensitivity <degrees per pixel>  mouse look
+//     shaders <directory>              where the .vs/.fs files are, the working directory by default
+//     reverse-z on|off                 main pass with reversed depth
+//     fixed-resolution on|off          main pass always at the window size
+//     telemetry <file>|unix:<path>     periodic memory and GPU upload snapshots (see telemetry.h)
+//     telemetry-interval <seconds>     time between them
+struct Settings
+{
+    int Width;
+    int Height;
+    std::string Vsync;
+    float FpsLimit;
+    std::string Latency;
+    std::string LatencyLog;
+    int Samples;
+    bool Tonemap;
+    float Exposure;
+    std::string Antialiasing;
+    float Bloom;
+    bool Headless;
+    std::string Scene;
+    std::string Portals;
+    std::string Animation;
+    int Frames;
+    int Threads;
+    float Near;
+    float Far;
+    float Fov;
+    float Speed;
+    float Sensitivity;
+    std::string Shaders;
+    bool ReverseZ;
+    bool FixedResolution;
+    std::string Telemetry;
+    float TelemetryInterval;
+
+    Settings()
+        : Width(SETTINGS_WIDTH), Height(SETTINGS_HEIGHT), Vsync("on"), FpsLimit(0.0f), Latency("normal"), Samples(0),
+        Tonemap(false), Exposure(POST_EXPOSURE), Antialiasing("off"), Bloom(0.0f), Headless(false),
+        Scene(SCENE_PATH), Portals(PORTALS_PATH), Animation(ANIMATION_PATH), Frames(0), Threads(0),
+        Near(SETTINGS_NEAR), Far(SETTINGS_FAR), Fov(ZOOM), Speed(SPEED), Sensitivity(SENSITIVITY),
+        ReverseZ(false), FixedResolution(false), TelemetryInterval(TELEMETRY_INTERVAL) {}
+
+    // the settings file (--config <file>, or SETTINGS_PATH when there is one), then the flags;
+    // flags that are not settings are left to the run modes
+    bool parse(int argc, char** argv)
+    {
+        std::string config;
+        for (int i = 1; i + 1 < argc; i++)
+            if (std::string(argv[i]) == "--config")
+                config = argv[i + 1];
+        if (config.empty() && std::ifstream(SETTINGS_PATH.c_str()))
+            config = SETTINGS_PATH;
+        if (!config.empty() && !load(config))
+            return false;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string flag = argv[i];
+            if (flag.compare(0, 2, "--") != 0 || !known(flag.substr(2)))
+                continue;
+            std::string name = flag.substr(2);
+            std::string value = "on";
+            if (!isSwitch(name))
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cout << "ERROR::SETTINGS::MISSING_VALUE: " << flag << std::endl;
+                    return false;
+                }
+                value = argv[++i];
+            }
+            if (!set(name, value))
+            {
+                std::cout << "ERROR::SETTINGS::BAD_VALUE: " << flag << " " << value << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::SETTINGS::FILE_NOT_FOUND: " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+        {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+            std::istringstream words(line);
+            std::string name, value, extra;
+            if (!(words >> name))
+                continue;
+            if (!(words >> value) || (words >> extra) || !set(name, value))
+            {
+                std::cout << "ERROR::SETTINGS::SYNTAX: " << path << ":" << lineNumber << ": " << line << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // one setting by name; false for an unknown name or a value out of range
+    bool set(const std::string& name, const std::string& value)
+    {
+        if (name == "width") return readInt(value, 1, Width);
+        if (name == "height") return readInt(value, 1, Height);
+        if (name == "vsync")
+        {
+            Vsync = value;
+            return value == "on" || value == "off" || value == "adaptive" || value == "driver";
+        }
+        if (name == "fps-limit") return readFloat(value, FpsLimit) && FpsLimit >= 0.0f;
+        if (name == "latency")
+        {
+            Latency = value;
+            return value == "normal" || value == "low";
+        }
+        if (name == "latency-log") return !(LatencyLog = value).empty();
+        if (name == "msaa") return readInt(value, 0, Samples);
+        if (name == "tonemap") return readSwitch(value, Tonemap);
+        if (name == "exposure") return readFloat(value, Exposure) && Exposure > 0.0f;
+        if (name == "aa")
+        {
+            Antialiasing = value;
+            return value == "fxaa" || value == "off";
+        }
+        if (name == "bloom") return readFloat(value, Bloom) && Bloom >= 0.0f;
+        if (name == "headless") return readSwitch(value, Headless);
+        if (name == "scene")
+        {
+            Scene = value;
+            std::string stem = value.substr(0, value.find_last_of('.'));
+            Portals = stem + ".portals";
+            Animation = stem + ".anim";
+            return !value.empty();
+        }
+        if (name == "portals") return !(Portals = value).empty();
+        if (name == "animation") return !(Animation = value).empty();
+        if (name == "frames") return readInt(value, 0, Frames);
+        if (name == "threads") return readInt(value, 0, Threads);
+        if (name == "near") return readFloat(value, Near) && Near > 0.0f;
+        if (name == "far") return readFloat(value, Far) && Far > 0.0f;
+        if (name == "fov") return readFloat(value, Fov) && Fov > 0.0f && Fov < 180.0f;
+        if (name == "speed") return readFloat(value, Speed);
+        if (name == "sensitivity") return readFloat(value, Sensitivity);
+        if (name == "shaders")
+        {
+            Shaders = value;
+            return true;
+        }
+        if (name == "reverse-z") return readSwitch(value, ReverseZ);
+        if (name == "fixed-resolution") return readSwitch(value, FixedResolution);
+        if (name == "telemetry") return !(Telemetry = value).empty();
+        if (name == "telemetry-interval") return readFloat(value, TelemetryInterval) && TelemetryInterval > 0.0f;
+        return false;
+    }
+
+    // PostFeature bits of the composite pass
+    int postFeatures() const
+    {
+        return (Tonemap ? POST_TONEMAP : 0) | (Antialiasing == "fxaa" ? POST_FXAA : 0) | (Bloom > 0.0f ? POST_BLOOM : 0);
+    }
+
+    // path of a shader file in the shader directory
+    std::string shader(const std::string& file) const
+    {
+        return Shaders.empty() ? file : Shaders + "/" + file;
+    }
+
+    // one line for benchmark logs
+    std::string describe() const
+    {
+        std::ostringstream line;
+        line << Width << "x" << Height << ", vsync " << Vsync;
+        if (FpsLimit > 0.0f)
+            line << ", limit " << FpsLimit << " fps";
+        line << ", latency " << Latency << ", msaa " << Samples << ", tonemap " << (Tonemap ? "on" : "off") << ", aa " << Antialiasing;
+        if (Bloom > 0.0f)
+            line << ", bloom " << Bloom;
+        line << ", threads " << Threads
+            << (ReverseZ ? ", reverse-z" : "") << (FixedResolution ? ", fixed resolution" : "") << ", " << Scene;
+        return line.str();
+    }
+
+private:
+    static bool known(const std::string& name)
+    {
+        static const char* names[] = { "width", "height", "vsync", "fps-limit", "latency", "latency-log", "msaa", "tonemap", "exposure", "aa", "bloom", "headless", "scene", "portals", "animation", "frames",
+            "threads", "near", "far", "fov", "speed", "sensitivity", "shaders", "reverse-z", "fixed-resolution", "telemetry", "telemetry-interval" };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (name == names[i])
+                return true;
+        return false;
+    }
+
+    static bool isSwitch(const std::string& name)
+    {
+        return name == "headless" || name == "reverse-z" || name == "fixed-resolution";
+    }
+
+    static bool readSwitch(const std::string& value, bool& out)
+    {
+        if (value == "on" || value == "true" || value == "1")
+            out = true;
+        else if (value == "off" || value == "false" || value == "0")
+            out = false;
+        else
+            return false;
+        return true;
+    }
+
+    static bool readInt(const std::string& value, int minimum, int& out)
+    {
+        char* end = NULL;
+        long number = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || number < minimum)
+            return false;
+        out = (int)number;
+        return true;
+    }
+
+    static bool readFloat(const std::string& value, float& out)
+    {
+        char* end = NULL;
+        out = strtof(value.c_str(), &end);
+        return !value.empty() && *end == '\0';
+    }
+};
+
+#endif
@@ -11,6 +11,8 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "gpu_resources.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -20,9 +22,10 @@ class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly; defines ("#define X\n" lines) go in right
+    // after the #version line of both stages, for variants of one source
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -52,6 +55,11 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        if (!defines.empty())
+        {
+            vertexCode.insert(vertexCode.find('\n') + 1, defines);
+            fragmentCode.insert(fragmentCode.find('\n') + 1, defines);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -82,6 +90,7 @@ public:
     void use() const
     {
         glUseProgram(ID);
+        gpuResources().countStateChange();
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
@@ -0,0 +1,10 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel;
+
+uniform mat4 lightSpace;
+
+void main()
+{
+    gl_Position = lightSpace * aModel * vec4(aPos, 1.0f);
+}
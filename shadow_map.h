@@ -0,0 +1,239 @@
+//
+//  shadow_map.h
+//  3D Object Drawing
+//
+
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "gpu_resources.h"
+
+#include <vector>
+#include <string>
+#include <cmath>
+
+// Default shadow values
+const int SHADOW_MAP_SIZE = 2048;
+const int SPOT_SHADOW_MAP_SIZE = 1024;
+const int NUM_CASCADES = 3;                 // keep in sync with fragmentShader.fs
+const float SHADOW_DISTANCE = 25.0f;        // cascades cover [near, SHADOW_DISTANCE] of the view
+const float CASCADE_SPLIT_LAMBDA = 0.75f;   // 0 = uniform splits, 1 = logarithmic splits
+const float CASCADE_CACHE_MARGIN = 0.25f;   // extra radius so small camera moves reuse the cached static layer
+const float SHADOW_CASTER_RANGE = 20.0f;    // how far behind a cascade casters are still captured
+
+
+// A depth-only render target holding one or more shadow layers (one per cascade).
+// Casters are split in two: static casters (walls, floor, furniture) go into a cached
+// array that is only re-rendered when a layer's light matrix changes, dynamic casters
+// (the fan blades) go into a second array that is cleared and re-rendered every frame.
+// The fragment shader samples both and keeps the darker result.
+class ShadowMap
+{
+public:
+    unsigned int StaticDepth;
+    unsigned int DynamicDepth;
+    unsigned int FBO;
+    int Size;
+    int Layers;
+    std::vector<glm::mat4> LightSpace;
+    std::vector<bool> StaticDirty;
+
+    ShadowMap(int size = SHADOW_MAP_SIZE, int layers = 1) : Size(size), Layers(layers), LightSpace(layers, glm::mat4(1.0f)), StaticDirty(layers, true)
+    {
+        StaticDepth = createDepthArray(staticArray, "static shadow map");
+        DynamicDepth = createDepthArray(dynamicArray, "dynamic shadow map");
+
+        framebuffer = gpuResources().create(GPU_FRAMEBUFFER, "shadow framebuffer");
+        FBO = gpuResources().get(framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, StaticDepth, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_MAP::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // forces every static layer to be re-rendered on the next shadow pass (e.g. after furniture was moved)
+    void invalidateStatic()
+    {
+        for (int i = 0; i < Layers; i++)
+            StaticDirty[i] = true;
+    }
+
+    // binds the framebuffer to one layer of the static or dynamic array and clears it
+    void beginLayer(unsigned int depthArray, int layer) const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, layer);
+        gpuResources().countStateChange();
+        glViewport(0, 0, Size, Size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // restores the default framebuffer and the window viewport
+    void end(int width, int height) const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+    }
+
+    // binds both arrays to consecutive texture units and points the shader's samplers at them;
+    // the sampler names are built on the first call, not every frame
+    void bind(const Shader& shader, const std::string& name, int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, StaticDepth);
+        if (name != samplerPrefix)
+        {
+            samplerPrefix = name;
+            staticSampler = name + "StaticShadow";
+            dynamicSampler = name + "DynamicShadow";
+        }
+        shader.setInt(staticSampler, unit);
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, DynamicDepth);
+        shader.setInt(dynamicSampler, unit + 1);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void release()
+    {
+        gpuResources().destroy(framebuffer);
+        gpuResources().destroy(staticArray);
+        gpuResources().destroy(dynamicArray);
+        FBO = StaticDepth = DynamicDepth = 0;
+    }
+
+private:
+    mutable std::string samplerPrefix, staticSampler, dynamicSampler;
+    GpuHandle staticArray;
+    GpuHandle dynamicArray;
+    GpuHandle framebuffer;
+
+    unsigned int createDepthArray(GpuHandle& handle, const char* label)
+    {
+        float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        handle = gpuResources().create(GPU_TEXTURE, label);
+        gpuResources().setBytes(handle, (size_t)Size * Size * Layers * 4);
+        unsigned int texture = gpuResources().get(handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, Size, Size, Layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        // hardware depth comparison gives 2x2 PCF for free through sampler2DArrayShadow
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return texture;
+    }
+};
+
+
+// Directional shadow split into cascades fitted to the camera frustum.
+// Each cascade is fitted with a bounding sphere (so its size does not change as the
+// camera turns) that is snapped to shadow texels and padded by CASCADE_CACHE_MARGIN.
+// As long as the new slice still fits inside the cached sphere the light matrix is
+// left untouched, so the cached static layer stays valid while the camera moves.
+class CascadedShadowMap : public ShadowMap
+{
+public:
+    float Splits[NUM_CASCADES];
+
+    CascadedShadowMap(int size = SHADOW_MAP_SIZE) : ShadowMap(size, NUM_CASCADES), lightDirection(0.0f)
+    {
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            Splits[i] = 0.0f;
+            centers[i] = glm::vec3(0.0f);
+            extents[i] = 0.0f;
+        }
+    }
+
+    // re-fits the cascades to the current view; only marks layers dirty whose light matrix changed
+    void update(const glm::mat4& view, float fovy, float aspect, float zNear, glm::vec3 direction)
+    {
+        direction = glm::normalize(direction);
+        if (direction != lightDirection)
+        {
+            lightDirection = direction;
+            for (int i = 0; i < NUM_CASCADES; i++)
+                extents[i] = 0.0f;
+        }
+
+        float sliceNear = zNear;
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            float p = (float)(i + 1) / (float)NUM_CASCADES;
+            float logSplit = zNear * std::pow(SHADOW_DISTANCE / zNear, p);
+            float uniformSplit = zNear + (SHADOW_DISTANCE - zNear) * p;
+            float sliceFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+            Splits[i] = sliceFar;
+
+            glm::vec3 center;
+            float radius;
+            sliceBounds(view, fovy, aspect, sliceNear, sliceFar, center, radius);
+            if (extents[i] == 0.0f || glm::distance(center, centers[i]) + radius > extents[i])
+            {
+                centers[i] = center;
+                extents[i] = radius * (1.0f + CASCADE_CACHE_MARGIN);
+                LightSpace[i] = fitLight(i);
+                StaticDirty[i] = true;
+            }
+            sliceNear = sliceFar;
+        }
+    }
+
+private:
+    glm::vec3 lightDirection;
+    glm::vec3 centers[NUM_CASCADES];
+    float extents[NUM_CASCADES];
+
+    // bounding sphere of the view frustum slice [sliceNear, sliceFar] in world space
+    void sliceBounds(const glm::mat4& view, float fovy, float aspect, float sliceNear, float sliceFar, glm::vec3& center, float& radius) const
+    {
+        glm::mat4 inv = glm::inverse(glm::perspective(fovy, aspect, sliceNear, sliceFar) * view);
+        glm::vec3 corners[8];
+        center = glm::vec3(0.0f);
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 p = inv * glm::vec4((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+            corners[i] = glm::vec3(p) / p.w;
+            center += corners[i];
+        }
+        center /= 8.0f;
+        radius = 0.0f;
+        for (int i = 0; i < 8; i++)
+            radius = std::max(radius, glm::distance(corners[i], center));
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+    }
+
+    glm::mat4 fitLight(int cascade)
+    {
+        float extent = extents[cascade];
+        glm::vec3 up = std::fabs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        // snap the center to whole shadow texels in light space to stop edge shimmering
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+        glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(centers[cascade], 1.0f));
+        float texel = 2.0f * extent / (float)Size;
+        lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+        lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+        glm::vec3 center = glm::vec3(glm::inverse(lightRotation) * glm::vec4(lightCenter, 1.0f));
+
+        float depth = extent + SHADOW_CASTER_RANGE;
+        glm::mat4 lightView = glm::lookAt(center - lightDirection * depth, center, up);
+        glm::mat4 lightProjection = glm::ortho(-extent, extent, -extent, extent, 0.0f, 2.0f * depth);
+        return lightProjection * lightView;
+    }
+};
+
+#endif
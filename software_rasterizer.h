@@ -0,0 +1,569 @@
+//
+//  software_rasterizer.h
+//  3D Object Drawing
+//
+
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+#include "instance_batch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_RASTERIZER_SSE2
+#endif
+
+// Default software rasterizer values
+const int RASTER_TILE_SIZE = 64;            // pixels per tile side; a multiple of 4
+const int RASTER_SUBPIXEL_BITS = 4;         // vertices are snapped to 1/16 pixel
+const float RASTER_GUARD_BAND = 4.0f;       // triangles are clipped to this many viewports around the screen
+
+
+// Lighting of the main pass without shadows and textures; see fragmentShader.fs
+struct SoftwareLighting
+{
+    float ambient;
+    glm::vec3 sunDirection;     // normalized
+    glm::vec3 sunColor;
+    glm::vec3 spotPosition;
+    glm::vec3 spotDirection;    // normalized
+    glm::vec3 spotColor;
+    float spotInnerCutoff;      // cosines
+    float spotOuterCutoff;
+};
+
+// CPU backend for the main pass, for machines without a GPU. It takes the same MeshBuffer
+// vertices and indices, InstanceBatch instances and culled commands and view/projection
+// matrices as the GL path and draws into an RGBA8 image with a depth buffer.
+//   draw() only collects batches; finish() transforms and clips every box on all threads,
+//   bins the triangles into screen tiles and then rasterizes whole tiles per thread, four
+//   pixels at a time (SSE2 where available). Coverage uses integer edge functions on snapped
+//   vertices with a top-left fill rule and every tile draws its triangles in submission order,
+//   so the image is the same bit for bit whatever the thread count.
+// Faces are lit with the ambient, sun and spot terms of fragmentShader.fs; there are no shadows
+// or textures, surfaces keep their flat color. Boxes with opacity under 1 are blended like the
+// GL path does it (weighted blended OIT, see transparency.h): each tile draws its opaque
+// triangles first, then accumulates the transparent ones without writing depth and resolves
+// them over the opaque color.
+class SoftwareRasterizer
+{
+public:
+    int Width;
+    int Height;
+    int Threads;
+    SoftwareLighting Lighting;
+    std::vector<uint32_t> Color;        // RGBA8, rows bottom up like GL, Stride pixels each
+    std::vector<float> Depth;           // NDC depth, cleared to 1
+    int Stride;
+
+    SoftwareRasterizer(int width, int height, int threads = 0)
+        : Width(width), Height(height), Threads(threads > 0 ? threads : std::max((int)std::thread::hardware_concurrency(), 1)),
+        meshBuffer(NULL)
+    {
+        tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        Stride = tilesX * RASTER_TILE_SIZE;
+        Color.resize((size_t)Stride * tilesY * RASTER_TILE_SIZE);
+        Depth.resize(Color.size());
+        bins.resize(Threads);
+    }
+
+    void setMatrices(const glm::mat4& view, const glm::mat4& projection)
+    {
+        viewProjection = projection * view;
+        // eye = -R^T t for a rigid view matrix
+        glm::vec3 t = glm::vec3(view[3]);
+        eye = -glm::vec3(glm::dot(glm::vec3(view[0]), t), glm::dot(glm::vec3(view[1]), t), glm::dot(glm::vec3(view[2]), t));
+    }
+
+    void clear(glm::vec3 color)
+    {
+        std::fill(Color.begin(), Color.end(), pack(color));
+        std::fill(Depth.begin(), Depth.end(), 1.0f);
+    }
+
+    // queues the visible boxes of a batch; all batches must use the same MeshBuffer
+    void draw(const MeshBuffer& meshes, const InstanceBatch& batch)
+    {
+        meshBuffer = &meshes;
+        // Commands and Instances are parallel; baseInstance is where upload() put the instance in the GPU pool
+        for (size_t i = 0; i < batch.Commands.size(); i++)
+            if (batch.Commands[i].instanceCount != 0)
+                boxes.push_back(Box(&batch.Commands[i], &batch.Instances[i]));
+    }
+
+    // draws everything queued since the last finish()
+    void finish()
+    {
+        if (boxes.empty())
+            return;
+        // geometry: each thread takes a contiguous run of boxes, so concatenating the
+        // threads' bins in thread order keeps the submission order
+        parallel(Threads, [this](int thread) {
+            size_t first = boxes.size() * thread / Threads;
+            size_t last = boxes.size() * (thread + 1) / Threads;
+            ThreadBins& bin = bins[thread];
+            bin.triangles.clear();
+            bin.tiles.assign((size_t)tilesX * tilesY, std::vector<uint32_t>());
+            for (size_t i = first; i < last; i++)
+                transformBox(boxes[i], bin);
+        });
+        // raster: whole tiles per thread, taken from a shared counter
+        std::atomic<int> nextTile(0);
+        parallel(Threads, [this, &nextTile](int) {
+            int tile;
+            while ((tile = nextTile++) < tilesX * tilesY)
+                rasterizeTile(tile);
+        });
+        boxes.clear();
+    }
+
+    // binary PPM, top row first
+    bool writeImage(const std::string& path) const
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::SOFTWARE_RASTERIZER::CANNOT_WRITE: " << path << std::endl;
+            return false;
+        }
+        file << "P6\n" << Width << " " << Height << "\n255\n";
+        std::vector<unsigned char> row(Width * 3);
+        for (int y = Height - 1; y >= 0; y--)
+        {
+            for (int x = 0; x < Width; x++)
+            {
+                uint32_t pixel = Color[(size_t)y * Stride + x];
+                row[x * 3 + 0] = (unsigned char)(pixel & 0xff);
+                row[x * 3 + 1] = (unsigned char)((pixel >> 8) & 0xff);
+                row[x * 3 + 2] = (unsigned char)((pixel >> 16) & 0xff);
+            }
+            file.write((const char*)row.data(), row.size());
+        }
+        return true;
+    }
+
+private:
+    struct Box
+    {
+        Box(const DrawElementsIndirectCommand* c, const InstanceData* i) : command(c), instance(i) {}
+        const DrawElementsIndirectCommand* command;
+        const InstanceData* instance;
+    };
+
+    struct ClipVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 world;
+    };
+
+    // a + b x + c y over pixel coordinates
+    struct Plane
+    {
+        float a, b, c;
+        float at(float x, float y) const { return a + b * x + c * y; }
+    };
+
+    struct Triangle
+    {
+        int64_t edgeA[3], edgeB[3], edgeC[3];   // edge i: A x + B y + C on subpixel coordinates
+        int32_t bias[3];                        // 0 on top-left edges, -1 elsewhere
+        int minX, minY, maxX, maxY;             // pixel bounds, inclusive
+        Plane depth;
+        Plane invW;
+        Plane worldOverW[3];
+        glm::vec3 normal;                       // facing the eye, like the shader's screen-space normal
+        glm::vec3 albedo;
+        float opacity;
+    };
+
+    // transparent layers over one tile: weighted color sum, revealage and weight sum per pixel
+    struct TileAccumulation
+    {
+        std::vector<glm::vec3> color;
+        std::vector<float> revealage;
+        std::vector<float> weight;
+
+        TileAccumulation()
+            : color(RASTER_TILE_SIZE * RASTER_TILE_SIZE, glm::vec3(0.0f)), revealage(RASTER_TILE_SIZE * RASTER_TILE_SIZE, 1.0f),
+            weight(RASTER_TILE_SIZE * RASTER_TILE_SIZE, 0.0f) {}
+    };
+
+    struct ThreadBins
+    {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<uint32_t> > tiles;      // triangle indices per tile
+    };
+
+    const MeshBuffer* meshBuffer;
+    glm::mat4 viewProjection;
+    glm::vec3 eye;
+    int tilesX;
+    int tilesY;
+    std::vector<Box> boxes;
+    std::vector<ThreadBins> bins;
+
+    template <class Work>
+    static void parallel(int threads, const Work& work)
+    {
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; i++)
+            workers.push_back(std::thread(work, i));
+        work(0);
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    static uint32_t pack(glm::vec3 color)
+    {
+        color = glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+        return (uint32_t)(color.x * 255.0f + 0.5f) | ((uint32_t)(color.y * 255.0f + 0.5f) << 8) |
+            ((uint32_t)(color.z * 255.0f + 0.5f) << 16) | 0xff000000u;
+    }
+
+    static glm::vec3 unpack(uint32_t pixel)
+    {
+        return glm::vec3((float)(pixel & 0xff), (float)((pixel >> 8) & 0xff), (float)((pixel >> 16) & 0xff)) / 255.0f;
+    }
+
+    void transformBox(const Box& box, ThreadBins& bin)
+    {
+        const std::vector<float>& vertices = meshBuffer->vertexData();
+        const std::vector<unsigned int>& indices = meshBuffer->indexData();
+        const glm::mat4& model = box.instance->model;
+        glm::vec3 albedo = glm::vec3(box.instance->surface);
+        float opacity = box.instance->opacity;
+        for (GLuint i = 0; i + 2 < box.command->count; i += 3)
+        {
+            ClipVertex triangle[3];
+            for (int k = 0; k < 3; k++)
+            {
+                const float* v = &vertices[(indices[box.command->firstIndex + i + k] + box.command->baseVertex) * 6];
+                glm::vec4 world = model * glm::vec4(v[0], v[1], v[2], 1.0f);
+                triangle[k].world = glm::vec3(world);
+                triangle[k].clip = viewProjection * world;
+            }
+            glm::vec3 normal = glm::cross(triangle[1].world - triangle[0].world, triangle[2].world - triangle[0].world);
+            if (glm::dot(normal, normal) == 0.0f)
+                continue;
+            normal = glm::normalize(normal);
+            if (glm::dot(normal, eye - triangle[0].world) < 0.0f)
+                normal = -normal;
+            clipAndBin(triangle, normal, albedo, opacity, bin);
+        }
+    }
+
+    // clips against near, far and the guard band and bins the resulting fan
+    void clipAndBin(const ClipVertex* triangle, glm::vec3 normal, glm::vec3 albedo, float opacity, ThreadBins& bin)
+    {
+        static const glm::vec4 planes[6] = {
+            glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), glm::vec4(0.0f, 0.0f, -1.0f, 1.0f),
+            glm::vec4(1.0f, 0.0f, 0.0f, RASTER_GUARD_BAND), glm::vec4(-1.0f, 0.0f, 0.0f, RASTER_GUARD_BAND),
+            glm::vec4(0.0f, 1.0f, 0.0f, RASTER_GUARD_BAND), glm::vec4(0.0f, -1.0f, 0.0f, RASTER_GUARD_BAND)
+        };
+        ClipVertex polygon[9], clipped[9];
+        int count = 3;
+        for (int k = 0; k < 3; k++)
+            polygon[k] = triangle[k];
+        for (int p = 0; p < 6 && count >= 3; p++)
+        {
+            int out = 0;
+            for (int k = 0; k < count; k++)
+            {
+                const ClipVertex& a = polygon[k];
+                const ClipVertex& b = polygon[(k + 1) % count];
+                float da = glm::dot(planes[p], a.clip);
+                float db = glm::dot(planes[p], b.clip);
+                if (da >= 0.0f)
+                    clipped[out++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f) && out < 9)
+                {
+                    float t = da / (da - db);
+                    clipped[out].clip = a.clip + (b.clip - a.clip) * t;
+                    clipped[out].world = a.world + (b.world - a.world) * t;
+                    out++;
+                }
+            }
+            count = out;
+            for (int k = 0; k < count; k++)
+                polygon[k] = clipped[k];
+        }
+        for (int k = 1; k + 1 < count; k++)
+            setup(polygon[0], polygon[k], polygon[k + 1], normal, albedo, opacity, bin);
+    }
+
+    void setup(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, glm::vec3 normal, glm::vec3 albedo, float opacity, ThreadBins& bin)
+    {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+        int64_t X[3], Y[3];
+        float sx[3], sy[3], invW[3];
+        const float subpixel = (float)(1 << RASTER_SUBPIXEL_BITS);
+        for (int k = 0; k < 3; k++)
+        {
+            invW[k] = 1.0f / v[k]->clip.w;
+            X[k] = (int64_t)std::floor((v[k]->clip.x * invW[k] * 0.5f + 0.5f) * Width * subpixel + 0.5f);
+            Y[k] = (int64_t)std::floor((v[k]->clip.y * invW[k] * 0.5f + 0.5f) * Height * subpixel + 0.5f);
+            sx[k] = X[k] / subpixel;
+            sy[k] = Y[k] / subpixel;
+        }
+        int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+        if (area == 0)
+            return;
+        // counter-clockwise from here on; there is no face culling, like the GL path
+        int order[3] = { 0, 1, 2 };
+        if (area < 0)
+        {
+            std::swap(order[1], order[2]);
+            area = -area;
+        }
+
+        Triangle triangle;
+        for (int e = 0; e < 3; e++)
+        {
+            int a = order[e], b = order[(e + 1) % 3];
+            triangle.edgeA[e] = Y[a] - Y[b];
+            triangle.edgeB[e] = X[b] - X[a];
+            triangle.edgeC[e] = -(triangle.edgeA[e] * X[a] + triangle.edgeB[e] * Y[a]);
+            // y is up: left edges run down, top edges run right to left
+            bool topLeft = triangle.edgeA[e] > 0 || (triangle.edgeA[e] == 0 && triangle.edgeB[e] < 0);
+            triangle.bias[e] = topLeft ? 0 : -1;
+        }
+        int64_t minX = std::min(X[0], std::min(X[1], X[2])), maxX = std::max(X[0], std::max(X[1], X[2]));
+        int64_t minY = std::min(Y[0], std::min(Y[1], Y[2])), maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+        triangle.minX = (int)std::max<int64_t>(minX >> RASTER_SUBPIXEL_BITS, 0);
+        triangle.minY = (int)std::max<int64_t>(minY >> RASTER_SUBPIXEL_BITS, 0);
+        triangle.maxX = (int)std::min<int64_t>(maxX >> RASTER_SUBPIXEL_BITS, Width - 1);
+        triangle.maxY = (int)std::min<int64_t>(maxY >> RASTER_SUBPIXEL_BITS, Height - 1);
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        // attributes that are affine in screen space: NDC depth, 1/w and world/w
+        float values[5][3];
+        for (int k = 0; k < 3; k++)
+        {
+            values[0][k] = v[k]->clip.z * invW[k];
+            values[1][k] = invW[k];
+            for (int c = 0; c < 3; c++)
+                values[2 + c][k] = v[k]->world[c] * invW[k];
+        }
+        Plane* planes[5] = { &triangle.depth, &triangle.invW, &triangle.worldOverW[0], &triangle.worldOverW[1], &triangle.worldOverW[2] };
+        float dx1 = sx[1] - sx[0], dy1 = sy[1] - sy[0], dx2 = sx[2] - sx[0], dy2 = sy[2] - sy[0];
+        float det = dx1 * dy2 - dx2 * dy1;
+        for (int p = 0; p < 5; p++)
+        {
+            float d1 = values[p][1] - values[p][0], d2 = values[p][2] - values[p][0];
+            planes[p]->b = (d1 * dy2 - d2 * dy1) / det;
+            planes[p]->c = (d2 * dx1 - d1 * dx2) / det;
+            planes[p]->a = values[p][0] - planes[p]->b * sx[0] - planes[p]->c * sy[0];
+        }
+        triangle.normal = normal;
+        triangle.albedo = albedo;
+        triangle.opacity = opacity;
+
+        uint32_t index = (uint32_t)bin.triangles.size();
+        bin.triangles.push_back(triangle);
+        for (int ty = triangle.minY / RASTER_TILE_SIZE; ty <= triangle.maxY / RASTER_TILE_SIZE; ty++)
+            for (int tx = triangle.minX / RASTER_TILE_SIZE; tx <= triangle.maxX / RASTER_TILE_SIZE; tx++)
+                bin.tiles[ty * tilesX + tx].push_back(index);
+    }
+
+    void rasterizeTile(int tile)
+    {
+        int tileX = (tile % tilesX) * RASTER_TILE_SIZE;
+        int tileY = (tile / tilesX) * RASTER_TILE_SIZE;
+        bool transparent = false;
+        for (size_t b = 0; b < bins.size(); b++)
+        {
+            const ThreadBins& bin = bins[b];
+            const std::vector<uint32_t>& list = bin.tiles[tile];
+            for (size_t i = 0; i < list.size(); i++)
+            {
+                if (bin.triangles[list[i]].opacity < 1.0f)
+                    transparent = true;
+                else
+                    rasterize(bin.triangles[list[i]], tileX, tileY, NULL);
+            }
+        }
+        if (!transparent)
+            return;
+
+        // transparent layers in submission order, so the sums come out the same on any thread count
+        TileAccumulation accumulation;
+        for (size_t b = 0; b < bins.size(); b++)
+        {
+            const ThreadBins& bin = bins[b];
+            const std::vector<uint32_t>& list = bin.tiles[tile];
+            for (size_t i = 0; i < list.size(); i++)
+                if (bin.triangles[list[i]].opacity < 1.0f)
+                    rasterize(bin.triangles[list[i]], tileX, tileY, &accumulation);
+        }
+        int width = std::min(RASTER_TILE_SIZE, Width - tileX);
+        int height = std::min(RASTER_TILE_SIZE, Height - tileY);
+        for (int y = 0; y < height; y++)
+        {
+            uint32_t* colorRow = &Color[(size_t)(tileY + y) * Stride + tileX];
+            for (int x = 0; x < width; x++)
+            {
+                int pixel = y * RASTER_TILE_SIZE + x;
+                float revealage = accumulation.revealage[pixel];
+                if (revealage >= 1.0f)
+                    continue;
+                glm::vec3 average = accumulation.color[pixel] / std::max(accumulation.weight[pixel], 1e-5f);
+                colorRow[x] = pack(average * (1.0f - revealage) + unpack(colorRow[x]) * revealage);
+            }
+        }
+    }
+
+    // opaque triangles write color and depth; with an accumulation, transparent ones are only
+    // depth tested and add to it
+    void rasterize(const Triangle& triangle, int tileX, int tileY, TileAccumulation* accumulation)
+    {
+        // rows and 4-pixel-aligned columns of the tile the triangle can touch
+        int x0 = std::max(triangle.minX, tileX) & ~3;
+        int x1 = std::min(triangle.maxX, tileX + RASTER_TILE_SIZE - 1);
+        int y0 = std::max(triangle.minY, tileY);
+        int y1 = std::min(triangle.maxY, tileY + RASTER_TILE_SIZE - 1);
+        const int64_t half = 1 << (RASTER_SUBPIXEL_BITS - 1);
+        int32_t stepX[3];
+        for (int e = 0; e < 3; e++)
+            stepX[e] = (int32_t)(triangle.edgeA[e] << RASTER_SUBPIXEL_BITS);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            // edge values at the first pixel center of the row; far outside values are clamped,
+            // which keeps their sign over the tile
+            int32_t row[3];
+            int64_t sampleX = ((int64_t)x0 << RASTER_SUBPIXEL_BITS) + half;
+            int64_t sampleY = ((int64_t)y << RASTER_SUBPIXEL_BITS) + half;
+            for (int e = 0; e < 3; e++)
+            {
+                int64_t value = triangle.edgeA[e] * sampleX + triangle.edgeB[e] * sampleY + triangle.edgeC[e] + triangle.bias[e];
+                row[e] = (int32_t)std::max<int64_t>(std::min<int64_t>(value, 1 << 30), -(1 << 30));
+            }
+            float centerY = y + 0.5f;
+            float* depthRow = &Depth[(size_t)y * Stride];
+            uint32_t* colorRow = &Color[(size_t)y * Stride];
+            for (int x = x0; x <= x1; x += 4)
+            {
+                int mask = coverage(row, stepX);
+                for (int e = 0; e < 3; e++)
+                    row[e] += 4 * stepX[e];
+                if (mask == 0)
+                    continue;
+                mask = depthTest(triangle.depth, x, centerY, depthRow + x, mask, accumulation == NULL);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!(mask & (1 << lane)))
+                        continue;
+                    if (accumulation == NULL)
+                    {
+                        colorRow[x + lane] = pack(shade(triangle, x + lane + 0.5f, centerY));
+                        continue;
+                    }
+                    // the weight of fragmentShader.fs: nearer layers count for more
+                    float viewDepth = 1.0f / triangle.invW.at(x + lane + 0.5f, centerY);
+                    float weight = triangle.opacity * glm::clamp(10.0f / (1e-5f + std::pow(viewDepth / 5.0f, 2.0f) + std::pow(viewDepth / 200.0f, 6.0f)), 1e-2f, 3e3f);
+                    int pixel = (y - tileY) * RASTER_TILE_SIZE + x + lane - tileX;
+                    accumulation->color[pixel] += shade(triangle, x + lane + 0.5f, centerY) * weight;
+                    accumulation->revealage[pixel] *= 1.0f - triangle.opacity;
+                    accumulation->weight[pixel] += weight;
+                }
+            }
+        }
+    }
+
+    // bit per pixel x .. x+3 inside all three edges
+    static int coverage(const int32_t* row, const int32_t* stepX)
+    {
+#ifdef SOFTWARE_RASTERIZER_SSE2
+        __m128i any = _mm_setzero_si128();
+        for (int e = 0; e < 3; e++)
+        {
+            __m128i values = _mm_add_epi32(_mm_set1_epi32(row[e]), laneSteps(stepX[e]));
+            any = _mm_or_si128(any, values);
+        }
+        // the sign bit of the or is set when any edge is negative
+        return ~_mm_movemask_ps(_mm_castsi128_ps(any)) & 0xf;
+#else
+        int mask = 0;
+        for (int lane = 0; lane < 4; lane++)
+            if ((row[0] + lane * stepX[0] | row[1] + lane * stepX[1] | row[2] + lane * stepX[2]) >= 0)
+                mask |= 1 << lane;
+        return mask;
+#endif
+    }
+
+#ifdef SOFTWARE_RASTERIZER_SSE2
+    // 0, step, 2 step, 3 step
+    static __m128i laneSteps(int32_t step)
+    {
+        return _mm_set_epi32(3 * step, 2 * step, step, 0);
+    }
+#endif
+
+    // less-than test of the covered pixels; returns the ones that passed and, with write, stores their depth
+    static int depthTest(const Plane& plane, int x, float centerY, float* depth, int mask, bool write)
+    {
+#ifdef SOFTWARE_RASTERIZER_SSE2
+        __m128 xs = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+        __m128 z = _mm_add_ps(_mm_set1_ps(plane.a + plane.c * centerY), _mm_mul_ps(_mm_set1_ps(plane.b), xs));
+        __m128 stored = _mm_loadu_ps(depth);
+        int passed = _mm_movemask_ps(_mm_cmplt_ps(z, stored)) & mask;
+        if (!write)
+            return passed;
+        static const int lanes[16][4] = {
+            {0,0,0,0}, {-1,0,0,0}, {0,-1,0,0}, {-1,-1,0,0}, {0,0,-1,0}, {-1,0,-1,0}, {0,-1,-1,0}, {-1,-1,-1,0},
+            {0,0,0,-1}, {-1,0,0,-1}, {0,-1,0,-1}, {-1,-1,0,-1}, {0,0,-1,-1}, {-1,0,-1,-1}, {0,-1,-1,-1}, {-1,-1,-1,-1}
+        };
+        __m128 select = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)lanes[passed]));
+        _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(select, z), _mm_andnot_ps(select, stored)));
+        return passed;
+#else
+        int passed = 0;
+        for (int lane = 0; lane < 4; lane++)
+        {
+            float z = plane.a + plane.c * centerY + plane.b * (x + lane + 0.5f);
+            if ((mask & (1 << lane)) && z < depth[lane])
+            {
+                if (write)
+                    depth[lane] = z;
+                passed |= 1 << lane;
+            }
+        }
+        return passed;
+#endif
+    }
+
+    glm::vec3 shade(const Triangle& triangle, float x, float y) const
+    {
+        float w = 1.0f / triangle.invW.at(x, y);
+        glm::vec3 position(triangle.worldOverW[0].at(x, y) * w, triangle.worldOverW[1].at(x, y) * w, triangle.worldOverW[2].at(x, y) * w);
+        const SoftwareLighting& l = Lighting;
+        glm::vec3 normal = triangle.normal;
+
+        float sunDiffuse = std::max(glm::dot(normal, -l.sunDirection), 0.0f);
+        glm::vec3 toSpot = l.spotPosition - position;
+        float spotDistance = glm::length(toSpot);
+        toSpot = toSpot / spotDistance;
+        float spotDiffuse = std::max(glm::dot(normal, toSpot), 0.0f);
+        float cone = glm::clamp((glm::dot(-toSpot, l.spotDirection) - l.spotOuterCutoff) / (l.spotInnerCutoff - l.spotOuterCutoff), 0.0f, 1.0f);
+        float attenuation = 1.0f / (1.0f + 0.09f * spotDistance + 0.032f * spotDistance * spotDistance);
+
+        glm::vec3 light = glm::vec3(l.ambient) + l.sunColor * sunDiffuse + l.spotColor * (spotDiffuse * cone * attenuation);
+        return triangle.albedo * light;
+    }
+};
+
+#endif
@@ -12,7 +12,7 @@
 class table {
 
 public:
-	std::vector<glm::mat4> modelMatrices;
+	std::vector<glm::mat4> modelMatrices;	// of the current draw call only: each one clears it first, or it grows every frame
 	float tox, toy, toz;
 	table(float x = 0, float y = 0, float z = 0) {
 		tox = x;
@@ -35,6 +35,7 @@ public:
 	}
 
 	Shader local_rotation(Shader ourShader, unsigned int VAO, unsigned int VAO2, unsigned int VAO3, unsigned int VAO4, unsigned int VAO5, float angle = 0) {
+		modelMatrices.clear();
 		glm::mat4 model;
 		float rotateAngle_X = 0;
 		float rotateAngle_Y = 0;
@@ -93,6 +94,7 @@ public:
 	}
 
 	Shader ret_shader(Shader ourShader, unsigned int VAO, unsigned int VAO2, unsigned int VAO3, unsigned int VAO4, unsigned int VAO5) {
+		modelMatrices.clear();
 		glm::mat4 model;
 		float rotateAngle_X = 0;
 		float rotateAngle_Y = 0;
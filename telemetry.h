@@ -0,0 +1,203 @@
+//
+//  telemetry.h
+//  3D Object Drawing
+//
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "frame_arena.h"
+#include "gpu_resources.h"
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Default telemetry values
+const float TELEMETRY_INTERVAL = 10.0f;         // seconds between snapshots
+const size_t TELEMETRY_LINE_SIZE = 1024;        // bytes of one snapshot at most
+
+
+// Snapshots of what a session holds on to, written every Interval seconds so that slow growth
+// over runs of days shows up in a collector instead of as an out-of-memory crash:
+//  - live heap bytes per HeapTag and the allocation count (see heapBytes() in frame_arena.h)
+//  - GL memory per object type as recorded in gpuResources(), and the streamed textures
+//  - per frame, averaged and at most over the interval: bytes uploaded, draw calls and state
+//    changes (GpuFrameCounters), and the frame time
+// Each snapshot is one JSON object on its own line:
+//     {"time":60.0,"frames":3600,"heap":{"total":...,"allocations":...,"other":...,"render":...,
+//      "simulation":...,"scene":...,"streaming":...},"gpu":{"buffers":...,"textures":...,
+//      "renderbuffers":...,"streamed_textures":...},"frame":{"ms":16.67,"upload_bytes":...,
+//      "upload_bytes_max":...,"draws":...,"draws_max":...,"state_changes":...,
+//      "state_changes_max":...},"dropped":0}
+// appended to a file, or sent as one datagram to a Unix socket ("unix:<path>") a collector
+// listens on. Sending never blocks: while nothing listens the snapshot is dropped and counted.
+// Snapshots are formatted into a fixed buffer, so the telemetry adds nothing to the heap it
+// measures. GL thread only.
+class Telemetry
+{
+public:
+    float Interval;
+    int Snapshots;              // written so far
+    int Dropped;                // not delivered to the socket
+
+    Telemetry()
+        : Interval(TELEMETRY_INTERVAL), Snapshots(0), Dropped(0), socketFd(-1), start(-1.0), intervalStart(-1.0), totalFrames(0)
+    {
+        resetInterval();
+    }
+
+    ~Telemetry()
+    {
+        release();
+    }
+
+    // target is a file path or unix:<socket path>
+    bool open(const std::string& target)
+    {
+        if (target.compare(0, 5, "unix:") != 0)
+        {
+            file.open(target.c_str(), std::ios::app);
+            if (!file)
+            {
+                std::cout << "ERROR::TELEMETRY::CANNOT_WRITE: " << target << std::endl;
+                return false;
+            }
+            return true;
+        }
+#ifdef _WIN32
+        std::cout << "ERROR::TELEMETRY::NO_UNIX_SOCKETS: " << target << std::endl;
+        return false;
+#else
+        std::string path = target.substr(5);
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            std::cout << "ERROR::TELEMETRY::BAD_SOCKET_PATH: " << target << std::endl;
+            return false;
+        }
+        socketFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (socketFd < 0)
+        {
+            std::cout << "ERROR::TELEMETRY::SOCKET_FAILED: " << target << std::endl;
+            return false;
+        }
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+#endif
+    }
+
+    bool enabled() const
+    {
+        return file.is_open() || socketFd >= 0;
+    }
+
+    // once per frame after gpuResources().endFrame(); time in seconds, streamedBytes the
+    // resident bytes of the texture streamer
+    void frame(double time, size_t streamedBytes)
+    {
+        if (!enabled())
+            return;
+        if (start < 0.0)
+            start = intervalStart = time;
+        const GpuFrameCounters& counters = gpuResources().lastFrame();
+        frames++;
+        totalFrames++;
+        uploadBytes += counters.UploadBytes;
+        draws += counters.Draws;
+        stateChanges += counters.StateChanges;
+        peak.UploadBytes = std::max(peak.UploadBytes, counters.UploadBytes);
+        peak.Draws = std::max(peak.Draws, counters.Draws);
+        peak.StateChanges = std::max(peak.StateChanges, counters.StateChanges);
+        if (time - intervalStart >= Interval)
+        {
+            snapshot(time, streamedBytes);
+            intervalStart = time;
+            resetInterval();
+        }
+    }
+
+    void release()
+    {
+        if (file.is_open())
+            file.close();
+#ifndef _WIN32
+        if (socketFd >= 0)
+            close(socketFd);
+#endif
+        socketFd = -1;
+    }
+
+private:
+    std::ofstream file;
+    int socketFd;
+#ifndef _WIN32
+    sockaddr_un address;
+#endif
+    double start;
+    double intervalStart;
+    long long totalFrames;
+    // this interval's frames and sums of their counters
+    int frames;
+    unsigned long long uploadBytes;
+    long long draws;
+    long long stateChanges;
+    GpuFrameCounters peak;
+
+    void resetInterval()
+    {
+        frames = 0;
+        uploadBytes = 0;
+        draws = stateChanges = 0;
+        peak = GpuFrameCounters();
+    }
+
+    void snapshot(double time, size_t streamedBytes)
+    {
+        long long heap[HEAP_TAG_COUNT];
+        long long heapTotal = 0;
+        for (int t = 0; t < HEAP_TAG_COUNT; t++)
+        {
+            heap[t] = (long long)heapBytes()[t].load(std::memory_order_relaxed);
+            heapTotal += heap[t];
+        }
+        double perFrame = frames > 0 ? 1.0 / frames : 0.0;
+        char line[TELEMETRY_LINE_SIZE];
+        int length = snprintf(line, sizeof(line),
+            "{\"time\":%.3f,\"frames\":%lld,"
+            "\"heap\":{\"total\":%lld,\"allocations\":%llu,\"other\":%lld,\"render\":%lld,\"simulation\":%lld,\"scene\":%lld,\"streaming\":%lld},"
+            "\"gpu\":{\"buffers\":%llu,\"textures\":%llu,\"renderbuffers\":%llu,\"streamed_textures\":%llu},"
+            "\"frame\":{\"ms\":%.3f,\"upload_bytes\":%.1f,\"upload_bytes_max\":%llu,\"draws\":%.1f,\"draws_max\":%d,\"state_changes\":%.1f,\"state_changes_max\":%d},"
+            "\"dropped\":%d}\n",
+            time - start, totalFrames,
+            heapTotal, (unsigned long long)heapAllocations().load(), heap[HEAP_OTHER], heap[HEAP_RENDER], heap[HEAP_SIMULATION], heap[HEAP_SCENE], heap[HEAP_STREAMING],
+            (unsigned long long)gpuResources().bytes(GPU_BUFFER), (unsigned long long)gpuResources().bytes(GPU_TEXTURE),
+            (unsigned long long)gpuResources().bytes(GPU_RENDERBUFFER), (unsigned long long)streamedBytes,
+            1000.0 * (time - intervalStart) * perFrame, uploadBytes * perFrame, (unsigned long long)peak.UploadBytes,
+            draws * perFrame, peak.Draws, stateChanges * perFrame, peak.StateChanges,
+            Dropped);
+        length = std::min(length, (int)sizeof(line) - 1);
+        if (file.is_open())
+        {
+            file.write(line, length);
+            file.flush();
+        }
+#ifndef _WIN32
+        if (socketFd >= 0 && sendto(socketFd, line, length, MSG_DONTWAIT, (const sockaddr*)&address, sizeof(address)) != length)
+            Dropped++;
+#endif
+        Snapshots++;
+    }
+};
+
+#endif
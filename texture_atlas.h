@@ -0,0 +1,367 @@
+//
+//  texture_atlas.h
+//  3D Object Drawing
+//
+
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "texture_streamer.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+
+// Default atlas values
+const int ATLAS_LAYER_SIZE = 1024;
+const std::string ATLAS_PATH = "textures/furniture_atlas";    // .ktx2 holds the texels, .atlas the regions
+
+
+// Where a source texture ended up: a layer of the GL_TEXTURE_2D_ARRAY and a rectangle
+// inside it. This is what goes into the per-instance data, so every textured box can
+// still be drawn by the same instanced draw.
+struct AtlasRegion
+{
+    float layer;        // -1 when the texture is not in the atlas (flat color)
+    glm::vec4 rect;     // xy = offset, zw = size, in layer UV space
+
+    AtlasRegion() : layer(-1.0f), rect(0.0f, 0.0f, 1.0f, 1.0f) {}
+};
+
+// Region table written next to the packed KTX2 array ("<name> <layer> <x> <y> <w> <h>" per line).
+class TextureAtlas
+{
+public:
+    int LayerSize;
+    int Layers;
+
+    TextureAtlas() : LayerSize(0), Layers(0) {}
+
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+            return false;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream in(line);
+            std::string name;
+            if (!(in >> name))
+                continue;
+            if (name == "#")
+            {
+                std::string key;
+                in >> key >> LayerSize >> key >> Layers;
+                continue;
+            }
+            AtlasRegion region;
+            in >> region.layer >> region.rect.x >> region.rect.y >> region.rect.z >> region.rect.w;
+            if (in)
+                regions[name] = region;
+        }
+        return true;
+    }
+
+    AtlasRegion find(const std::string& name) const
+    {
+        std::map<std::string, AtlasRegion>::const_iterator it = regions.find(name);
+        return it == regions.end() ? AtlasRegion() : it->second;
+    }
+
+private:
+    std::map<std::string, AtlasRegion> regions;
+};
+
+
+// Bottom-left skyline packer for one square layer. Every rectangle is placed at a multiple
+// of its own size, so for power-of-two textures each mip level of the layer still holds
+// whole mip levels of the sources.
+class SkylinePacker
+{
+public:
+    SkylinePacker(int size) : Size(size)
+    {
+        Segment s = { 0, 0, size };
+        skyline.push_back(s);
+    }
+
+    int Size;
+
+    bool insert(int w, int h, int& outX, int& outY)
+    {
+        int bestX = 0, bestY = INT_MAX;
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            int x = alignUp(skyline[i].x, w);
+            if (x + w > Size)
+                continue;
+            int y = 0;
+            for (size_t j = 0; j < skyline.size(); j++)
+                if (skyline[j].x < x + w && skyline[j].x + skyline[j].width > x)
+                    y = std::max(y, skyline[j].y);
+            y = alignUp(y, h);
+            if (y + h > Size)
+                continue;
+            if (y < bestY || (y == bestY && x < bestX))
+            {
+                bestX = x;
+                bestY = y;
+            }
+        }
+        if (bestY == INT_MAX)
+            return false;
+
+        std::vector<Segment> next;
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            const Segment& s = skyline[i];
+            int end = s.x + s.width;
+            if (end <= bestX || s.x >= bestX + w)
+            {
+                next.push_back(s);
+                continue;
+            }
+            if (s.x < bestX)
+            {
+                Segment left = { s.x, s.y, bestX - s.x };
+                next.push_back(left);
+            }
+            if (end > bestX + w)
+            {
+                Segment right = { bestX + w, s.y, end - bestX - w };
+                next.push_back(right);
+            }
+        }
+        Segment placed = { bestX, bestY + h, w };
+        next.push_back(placed);
+        std::sort(next.begin(), next.end(), [](const Segment& a, const Segment& b) { return a.x < b.x; });
+        skyline.clear();
+        for (size_t i = 0; i < next.size(); i++)
+        {
+            if (!skyline.empty() && skyline.back().y == next[i].y)
+                skyline.back().width += next[i].width;
+            else
+                skyline.push_back(next[i]);
+        }
+        outX = bestX;
+        outY = bestY;
+        return true;
+    }
+
+private:
+    struct Segment { int x, y, width; };
+    std::vector<Segment> skyline;
+
+    static int alignUp(int v, int a)
+    {
+        return (v + a - 1) / a * a;
+    }
+};
+
+
+// Build step: packs power-of-two DDS/KTX2 textures of one format into the layers of a KTX2
+// texture array (read back by TextureStreamer) and writes the region table alongside it.
+// Region names are the file names without directory and extension.
+inline bool packTextureAtlas(const std::vector<std::string>& inputs, int layerSize, const std::string& outputPrefix)
+{
+    struct Source
+    {
+        std::string name;
+        TextureLevels levels;
+        int x, y, layer;
+    };
+    std::vector<Source> sources;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        Source s;
+        size_t slash = inputs[i].find_last_of("/\\");
+        s.name = inputs[i].substr(slash == std::string::npos ? 0 : slash + 1);
+        s.name = s.name.substr(0, s.name.find('.'));
+        s.levels = TextureStreamer::readLevels(inputs[i], 0);
+        const TextureLevels& t = s.levels;
+        if (!t.ok || t.layers > 0 || t.width > layerSize || t.height > layerSize || (t.width & (t.width - 1)) || (t.height & (t.height - 1)))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::UNSUPPORTED_INPUT: " << inputs[i] << std::endl;
+            return false;
+        }
+        if (!sources.empty() && (t.internalFormat != sources[0].levels.internalFormat || t.format != sources[0].levels.format))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::FORMAT_MISMATCH: " << inputs[i] << std::endl;
+            return false;
+        }
+        sources.push_back(s);
+    }
+    if (sources.empty())
+        return false;
+
+    // largest first keeps the skyline flat
+    std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) {
+        return a.levels.height != b.levels.height ? a.levels.height > b.levels.height : a.levels.width > b.levels.width;
+    });
+    std::vector<SkylinePacker> layers;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        Source& s = sources[i];
+        s.layer = -1;
+        for (size_t l = 0; l < layers.size() && s.layer < 0; l++)
+            if (layers[l].insert(s.levels.width, s.levels.height, s.x, s.y))
+                s.layer = (int)l;
+        if (s.layer < 0)
+        {
+            layers.push_back(SkylinePacker(layerSize));
+            layers.back().insert(s.levels.width, s.levels.height, s.x, s.y);
+            s.layer = (int)layers.size() - 1;
+        }
+    }
+
+    // texel blocks: 4x4 for BCn, single pixels otherwise
+    const TextureLevels& first = sources[0].levels;
+    int unit = first.compressed ? 4 : 1;
+    size_t unitBytes = 4;
+    if (first.compressed)
+        unitBytes = (first.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16;
+
+    // stop before any source would shrink below one block
+    int levelCount = 1;
+    while ((layerSize >> levelCount) >= unit)
+        levelCount++;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const TextureLevels& t = sources[i].levels;
+        int n = 1;
+        while (n < t.levelCount && (std::min(t.width, t.height) >> n) >= unit)
+            n++;
+        levelCount = std::min(levelCount, n);
+    }
+
+    std::vector<std::vector<unsigned char> > levelData(levelCount);
+    for (int level = 0; level < levelCount; level++)
+    {
+        size_t layerUnits = (size_t)(layerSize >> level) / unit;
+        size_t layerBytes = layerUnits * layerUnits * unitBytes;
+        levelData[level].assign(layerBytes * layers.size(), 0);
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            const Source& s = sources[i];
+            size_t rowUnits = (size_t)(s.levels.width >> level) / unit;
+            size_t rows = (size_t)(s.levels.height >> level) / unit;
+            size_t x = (size_t)(s.x >> level) / unit;
+            size_t y = (size_t)(s.y >> level) / unit;
+            const unsigned char* src = &s.levels.data[level][0];
+            unsigned char* dst = &levelData[level][layerBytes * s.layer];
+            for (size_t row = 0; row < rows; row++)
+                memcpy(dst + ((y + row) * layerUnits + x) * unitBytes, src + row * rowUnits * unitBytes, rowUnits * unitBytes);
+        }
+    }
+
+    // KTX2 container: header, level index, data format descriptor, then levels smallest first
+    uint32_t vkFormat = 0, colorModel = 1, transfer = 1;
+    switch (first.internalFormat)
+    {
+    case GL_RGBA8: vkFormat = first.format == GL_BGRA ? 44 : 37; break;
+    case GL_SRGB8_ALPHA8: vkFormat = 43; transfer = 2; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: vkFormat = 133; colorModel = 128; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: vkFormat = 135; colorModel = 129; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: vkFormat = 137; colorModel = 130; break;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: vkFormat = 145; colorModel = 134; break;
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: vkFormat = 146; colorModel = 134; transfer = 2; break;
+    }
+
+    // one sample per channel: { bit offset, bit length, channel id (| 0x80 linear) }
+    std::vector<uint32_t> samples;
+    uint32_t upper = first.compressed ? 0xFFFFFFFFu : 255u;
+    if (!first.compressed)
+    {
+        uint32_t rgb[3] = { 0, 1, 2 };
+        if (vkFormat == 44)
+            std::swap(rgb[0], rgb[2]);
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            uint32_t channel = c < 3 ? rgb[c] : (15u | (transfer == 2 ? 0x80u : 0u));
+            samples.push_back((c * 8) | (7u << 16) | (channel << 24));
+        }
+    }
+    else if (colorModel == 129 || colorModel == 130)
+    {
+        samples.push_back(0 | (63u << 16) | (15u << 24));
+        samples.push_back(64 | (63u << 16) | (0u << 24));
+    }
+    else
+        samples.push_back(0 | ((unitBytes * 8 - 1) << 16) | ((colorModel == 128 ? 1u : 0u) << 24));
+
+    std::vector<uint32_t> dfd;
+    uint32_t blockSize = 24 + 16 * (uint32_t)samples.size();
+    dfd.push_back(4 + blockSize);
+    dfd.push_back(0);
+    dfd.push_back(2 | (blockSize << 16));
+    dfd.push_back(colorModel | (1u << 8) | (transfer << 16));
+    dfd.push_back(first.compressed ? (3u | (3u << 8)) : 0u);
+    dfd.push_back((uint32_t)unitBytes);
+    dfd.push_back(0);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        dfd.push_back(samples[i]);
+        dfd.push_back(0);
+        dfd.push_back(0);
+        dfd.push_back(upper);
+    }
+
+    const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    std::vector<unsigned char> out(identifier, identifier + 12);
+    auto u32 = [&out](uint32_t v) { for (int b = 0; b < 4; b++) out.push_back((unsigned char)(v >> (8 * b))); };
+    auto u64 = [&u32](uint64_t v) { u32((uint32_t)v); u32((uint32_t)(v >> 32)); };
+    uint32_t dfdOffset = 80 + 24 * (uint32_t)levelCount;
+    uint32_t dfdBytes = (uint32_t)dfd.size() * 4;
+    u32(vkFormat); u32(1); u32(layerSize); u32(layerSize); u32(0);
+    u32((uint32_t)layers.size()); u32(1); u32((uint32_t)levelCount); u32(0);
+    u32(dfdOffset); u32(dfdBytes); u32(0); u32(0); u64(0); u64(0);
+
+    std::vector<uint64_t> offsets(levelCount);
+    uint64_t offset = dfdOffset + dfdBytes;
+    for (int level = levelCount - 1; level >= 0; level--)
+    {
+        offset = (offset + 15) / 16 * 16;
+        offsets[level] = offset;
+        offset += levelData[level].size();
+    }
+    for (int level = 0; level < levelCount; level++)
+    {
+        u64(offsets[level]);
+        u64(levelData[level].size());
+        u64(levelData[level].size());
+    }
+    for (size_t i = 0; i < dfd.size(); i++)
+        u32(dfd[i]);
+    for (int level = levelCount - 1; level >= 0; level--)
+    {
+        out.resize((size_t)offsets[level], 0);
+        out.insert(out.end(), levelData[level].begin(), levelData[level].end());
+    }
+
+    std::ofstream texture((outputPrefix + ".ktx2").c_str(), std::ios::binary);
+    texture.write((const char*)&out[0], out.size());
+    std::ofstream table((outputPrefix + ".atlas").c_str());
+    table << "# layerSize " << layerSize << " layers " << layers.size() << "\n";
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const Source& s = sources[i];
+        table << s.name << " " << s.layer << " "
+            << (float)s.x / layerSize << " " << (float)s.y / layerSize << " "
+            << (float)s.levels.width / layerSize << " " << (float)s.levels.height / layerSize << "\n";
+    }
+    std::cout << "packed " << sources.size() << " textures into " << layers.size() << " layer(s), " << levelCount << " mip levels" << std::endl;
+    return texture.good() && table.good();
+}
+
+#endif
@@ -0,0 +1,652 @@
+//
+//  texture_streamer.h
+//  3D Object Drawing
+//
+
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "frame_arena.h"
+#include "gpu_resources.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+// Default streaming values
+const size_t TEXTURE_BUDGET = 64u * 1024u * 1024u;        // resident GPU bytes for all streamed textures
+const size_t TEXTURE_UPLOAD_PER_FRAME = 4u * 1024u * 1024u; // bytes pushed through the PBO ring per frame
+const int TEXTURE_TAIL_SIZE = 64;                          // levels at or below this size are always loaded
+const int TEXTURE_PBO_COUNT = 3;
+const int TEXTURE_MAX_SIZE = 16384;                         // GL_MAX_TEXTURE_SIZE every GL 4 driver has; the workers have no context to ask
+const int TEXTURE_MAX_LAYERS = 2048;                        // GL_MAX_ARRAY_TEXTURE_LAYERS likewise
+
+
+// Mip levels of one texture (or texture array) as stored on disk (DDS or KTX2). Only the levels that were
+// asked for are read; the level sizes of the whole chain are always filled in.
+struct TextureLevels
+{
+    int id;
+    int firstLevel;
+    int width, height;          // size of level 0 in the file
+    int layers;                 // array layers, 0 for a plain 2D texture
+    int levelCount;
+    bool compressed;
+    GLenum internalFormat, format, type;
+    std::vector<size_t> levelBytes;
+    std::vector<std::vector<unsigned char> > data; // data[i] holds file level firstLevel + i
+    bool ok;
+};
+
+// Streams DDS/KTX2 textures (and layered KTX2 texture arrays) in the background and keeps only the mip levels the current
+// view needs resident, under a fixed memory budget.
+//  - files are parsed and read on worker threads, one job per (texture, finest level)
+//  - uploads go through a small ring of pixel buffer objects, capped per frame
+//  - a texture's GL object holds levels [ResidentLevel, levelCount); a finer or coarser
+//    set is built in a fresh object and swapped in once every level has arrived
+//  - when the wanted levels do not fit the budget, the least recently used textures are
+//    dropped one level at a time
+class TextureStreamer
+{
+public:
+    TextureStreamer(size_t budget = TEXTURE_BUDGET, unsigned int workers = 0, size_t uploadPerFrame = TEXTURE_UPLOAD_PER_FRAME)
+        : Budget(budget), UploadPerFrame(uploadPerFrame), frame(0), pboIndex(0), stopping(false)
+    {
+        for (int i = 0; i < TEXTURE_PBO_COUNT; i++)
+            pbo[i] = 0;
+        if (workers == 0)
+        {
+            // one core is left to the GL thread; hardware_concurrency() is 0 when unknown
+            unsigned int cores = std::thread::hardware_concurrency();
+            workers = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned int i = 0; i < workers; i++)
+            threads.push_back(std::thread(&TextureStreamer::workerLoop, this));
+    }
+
+    ~TextureStreamer()
+    {
+        stop();
+    }
+
+    size_t Budget;
+    size_t UploadPerFrame;
+
+    // registers a texture file; the coarse tail of its mip chain is queued right away
+    int load(const std::string& path)
+    {
+        Entry e;
+        e.path = path;
+        entries.push_back(e);
+        int id = (int)entries.size() - 1;
+        schedule(id, INT32_MAX);
+        return id;
+    }
+
+    // marks a texture as used this frame; texelsPerPixel is how many level-0 texels land on
+    // one screen pixel, so log2 of it is the finest level worth keeping resident
+    void request(int id, float texelsPerPixel)
+    {
+        if (id < 0 || id >= (int)entries.size())
+            return;
+        Entry& e = entries[id];
+        e.lastUsed = frame;
+        if (e.levelCount == 0)
+            return;
+        int level = texelsPerPixel > 1.0f ? (int)std::floor(std::log2(texelsPerPixel)) : 0;
+        e.wanted = std::min(level, e.tailLevel);
+        if (e.wantedFrame != frame || e.wanted < e.frameWanted)
+            e.frameWanted = e.wanted;
+        e.wantedFrame = frame;
+    }
+
+    // binds whatever is resident; returns false while nothing has arrived yet (or the file failed)
+    bool bind(int id, int unit) const
+    {
+        if (id < 0 || id >= (int)entries.size() || entries[id].texture == 0)
+            return false;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(entries[id].textureTarget, entries[id].texture);
+        glActiveTexture(GL_TEXTURE0);
+        return true;
+    }
+
+    // once per frame on the GL thread: apply the budget, queue loads and upload finished ones
+    void update()
+    {
+        createBuffers();
+        collectResults();
+        fitBudget();
+        for (int id = 0; id < (int)entries.size(); id++)
+        {
+            Entry& e = entries[id];
+            if (e.levelCount == 0 || e.failed)
+                continue;
+            if (e.target != e.ResidentLevel && e.jobLevel < 0 && e.pending.data.empty())
+                schedule(id, e.target);
+            // dropping levels: stop sampling them now, the memory is freed when the coarser set lands
+            int baseLevel = std::max(0, e.target - e.ResidentLevel);
+            if (e.texture != 0 && baseLevel != e.baseLevel)
+            {
+                glBindTexture(e.textureTarget, e.texture);
+                glTexParameteri(e.textureTarget, GL_TEXTURE_BASE_LEVEL, baseLevel);
+                glBindTexture(e.textureTarget, 0);
+                e.baseLevel = baseLevel;
+            }
+        }
+        upload();
+        frame++;
+    }
+
+    // bytes currently held by GL texture objects (including sets still being uploaded)
+    size_t residentBytes() const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].texture != 0)
+                total += chainBytes(entries[i], entries[i].ResidentLevel);
+            if (entries[i].pendingTexture != 0)
+                total += chainBytes(entries[i], entries[i].pending.firstLevel);
+        }
+        return total;
+    }
+
+    int residentLevel(int id) const
+    {
+        return entries[id].ResidentLevel;
+    }
+
+    // width of level 0 in texels, 0 until the file header has been read
+    int width(int id) const
+    {
+        return (id < 0 || id >= (int)entries.size()) ? 0 : entries[id].width;
+    }
+
+    // reads levels [firstLevel, levelCount) of a DDS or KTX2 file; firstLevel is clamped to
+    // the tail so the first request for a texture only pulls in its small levels
+    static TextureLevels readLevels(const std::string& path, int firstLevel)
+    {
+        TextureLevels t;
+        t.id = -1;
+        t.ok = false;
+        t.firstLevel = 0;
+        t.width = t.height = t.layers = t.levelCount = 0;
+        t.compressed = false;
+        t.internalFormat = t.format = t.type = 0;
+
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file)
+            return t;
+        file.seekg(0, std::ios::end);
+        uint64_t fileBytes = (uint64_t)file.tellg();
+        file.seekg(0);
+        char magic[12];
+        if (!file.read(magic, 12))
+            return t;
+
+        std::vector<uint64_t> offsets;
+        int blockBytes = 0;
+        if (memcmp(magic, "DDS ", 4) == 0)
+        {
+            uint64_t offset = 0;
+            if (!parseDDS(file, t, blockBytes, offset))
+                return t;
+            for (int i = 0; i < t.levelCount; i++)
+            {
+                offsets.push_back(offset);
+                offset += levelSize(t, i, blockBytes);
+            }
+        }
+        else if (memcmp(magic, "\xABKTX 20\xBB\r\n\x1A\n", 12) == 0)
+        {
+            if (!parseKTX2(file, t, blockBytes, offsets))
+                return t;
+        }
+        else
+            return t;
+
+        // every level has to be in the file before anything is allocated for it
+        for (int i = 0; i < t.levelCount; i++)
+        {
+            uint64_t bytes = levelSize(t, i, blockBytes);
+            if (offsets[i] > fileBytes || bytes > fileBytes - offsets[i])
+                return t;
+            t.levelBytes.push_back((size_t)bytes);
+        }
+
+        int tail = t.levelCount - 1;
+        while (tail > 0 && std::max(t.width >> (tail - 1), t.height >> (tail - 1)) <= TEXTURE_TAIL_SIZE)
+            tail--;
+        t.firstLevel = std::max(0, std::min(firstLevel, tail));
+        for (int i = t.firstLevel; i < t.levelCount; i++)
+        {
+            std::vector<unsigned char> level(t.levelBytes[i]);
+            file.seekg((std::streamoff)offsets[i]);
+            if (!file.read((char*)&level[0], level.size()))
+                return t;
+            t.data.push_back(level);
+        }
+        t.ok = true;
+        return t;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); i++)
+            if (threads[i].joinable())
+                threads[i].join();
+        threads.clear();
+    }
+
+    void release()
+    {
+        stop();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            glDeleteTextures(1, &entries[i].texture);
+            glDeleteTextures(1, &entries[i].pendingTexture);
+        }
+        glDeleteBuffers(TEXTURE_PBO_COUNT, pbo);
+    }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        GLenum textureTarget = GL_TEXTURE_2D;  // GL_TEXTURE_2D_ARRAY for layered KTX2 files
+        unsigned int texture = 0;
+        unsigned int pendingTexture = 0;
+        TextureLevels pending;          // levels being uploaded into pendingTexture
+        int pendingNext = 0;            // next entry of pending.data to upload
+        int ResidentLevel = 0;          // finest file level held by texture
+        int baseLevel = 0;              // GL_TEXTURE_BASE_LEVEL of texture
+        int levelCount = 0;             // 0 until the header has been read
+        int tailLevel = 0;
+        int width = 0, height = 0;
+        std::vector<size_t> levelBytes;
+        int wanted = 0, frameWanted = 0, target = 0;
+        int jobLevel = -1;              // level of the job in flight, -1 if none
+        unsigned long long wantedFrame = 0, lastUsed = 0;
+        bool failed = false;
+    };
+    struct Job
+    {
+        int id;
+        int firstLevel;
+        std::string path;
+    };
+
+    std::vector<Entry> entries;
+    unsigned long long frame;
+    unsigned int pbo[TEXTURE_PBO_COUNT];
+    int pboIndex;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::vector<TextureLevels> results;
+    bool stopping;
+
+    void createBuffers()
+    {
+        if (pbo[0] != 0)
+            return;
+        glGenBuffers(TEXTURE_PBO_COUNT, pbo);
+        for (int i = 0; i < TEXTURE_PBO_COUNT; i++)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, UploadPerFrame, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    static size_t chainBytes(const Entry& e, int firstLevel)
+    {
+        size_t total = 0;
+        for (int i = firstLevel; i < (int)e.levelBytes.size(); i++)
+            total += e.levelBytes[i];
+        return total;
+    }
+
+    void schedule(int id, int firstLevel)
+    {
+        Job job;
+        job.id = id;
+        job.firstLevel = firstLevel;
+        job.path = entries[id].path;
+        entries[id].jobLevel = firstLevel;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        wake.notify_one();
+    }
+
+    void collectResults()
+    {
+        std::vector<TextureLevels> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.swap(results);
+        }
+        for (size_t i = 0; i < done.size(); i++)
+        {
+            Entry& e = entries[done[i].id];
+            e.jobLevel = -1;
+            if (!done[i].ok)
+            {
+                if (!e.failed)
+                    std::cout << "ERROR::TEXTURE_STREAMER::FAILED_TO_LOAD: " << e.path << std::endl;
+                e.failed = true;
+                continue;
+            }
+            if (e.levelCount == 0)
+            {
+                e.levelCount = done[i].levelCount;
+                e.width = done[i].width;
+                e.height = done[i].height;
+                e.levelBytes = done[i].levelBytes;
+                e.textureTarget = done[i].layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+                e.tailLevel = done[i].firstLevel;
+                e.target = e.wanted = e.frameWanted = e.ResidentLevel = e.tailLevel;
+            }
+            e.pending = done[i];
+            e.pendingNext = 0;
+            glGenTextures(1, &e.pendingTexture);
+            glBindTexture(e.textureTarget, e.pendingTexture);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(e.textureTarget, GL_TEXTURE_MAX_LEVEL, (int)e.pending.data.size() - 1);
+            glBindTexture(e.textureTarget, 0);
+        }
+    }
+
+    // picks each texture's target level: the finest level requested this frame, coarsened
+    // in least-recently-used order until the sum of all targets fits the budget
+    void fitBudget()
+    {
+        FrameVector<int> order(frameArena());
+        order.reserve(entries.size());
+        size_t total = 0;
+        for (int id = 0; id < (int)entries.size(); id++)
+        {
+            Entry& e = entries[id];
+            if (e.levelCount == 0 || e.failed)
+                continue;
+            // not seen for a while: fall back to the tail
+            e.target = (e.wantedFrame + 1 >= frame) ? e.frameWanted : e.tailLevel;
+            total += chainBytes(e, e.target);
+            order.push_back(id);
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return entries[a].lastUsed < entries[b].lastUsed; });
+        bool changed = true;
+        while (total > Budget && changed)
+        {
+            changed = false;
+            for (size_t i = 0; i < order.size() && total > Budget; i++)
+            {
+                Entry& e = entries[order[i]];
+                if (e.target >= e.tailLevel)
+                    continue;
+                total -= e.levelBytes[e.target];
+                e.target++;
+                changed = true;
+            }
+        }
+    }
+
+    // copies pending levels into this frame's PBO and hands them to GL, UploadPerFrame bytes at most
+    void upload()
+    {
+        struct Copy { size_t id; int index; size_t offset; bool direct; };
+        FrameVector<Copy> copies(frameArena());
+        size_t used = 0;
+        unsigned char* mapped = NULL;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pboIndex]);
+        for (size_t id = 0; id < entries.size() && used < UploadPerFrame; id++)
+        {
+            Entry& e = entries[id];
+            while (e.pendingTexture != 0 && e.pendingNext < (int)e.pending.data.size())
+            {
+                const std::vector<unsigned char>& level = e.pending.data[e.pendingNext];
+                if (level.size() > UploadPerFrame && used == 0)
+                {
+                    // larger than a whole ring slot: this frame uploads it straight from client memory
+                    Copy copy = { id, e.pendingNext++, 0, true };
+                    copies.push_back(copy);
+                    used = UploadPerFrame;
+                    break;
+                }
+                if (used + level.size() > UploadPerFrame)
+                    break;
+                if (mapped == NULL)
+                    mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, UploadPerFrame, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+                memcpy(mapped + used, &level[0], level.size());
+                Copy copy = { id, e.pendingNext++, used, false };
+                copies.push_back(copy);
+                used += level.size();
+            }
+        }
+        // the buffer has to be unmapped before GL may source texel data from it
+        if (mapped != NULL)
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        for (size_t i = 0; i < copies.size(); i++)
+        {
+            const Entry& e = entries[copies[i].id];
+            const std::vector<unsigned char>& level = e.pending.data[copies[i].index];
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, copies[i].direct ? 0 : pbo[pboIndex]);
+            uploadLevel(e, copies[i].index, copies[i].direct ? (const void*)&level[0] : (const void*)copies[i].offset, level.size());
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for (size_t id = 0; id < entries.size(); id++)
+            if (entries[id].pendingTexture != 0 && entries[id].pendingNext == (int)entries[id].pending.data.size())
+                swapIn(entries[id]);
+        pboIndex = (pboIndex + 1) % TEXTURE_PBO_COUNT;
+    }
+
+    void uploadLevel(const Entry& e, int index, const void* source, size_t size)
+    {
+        int fileLevel = e.pending.firstLevel + index;
+        int w = std::max(1, e.width >> fileLevel);
+        int h = std::max(1, e.height >> fileLevel);
+        glBindTexture(e.textureTarget, e.pendingTexture);
+        if (e.textureTarget == GL_TEXTURE_2D_ARRAY && e.pending.compressed)
+            glCompressedTexImage3D(e.textureTarget, index, e.pending.internalFormat, w, h, e.pending.layers, 0, (GLsizei)size, source);
+        else if (e.textureTarget == GL_TEXTURE_2D_ARRAY)
+            glTexImage3D(e.textureTarget, index, e.pending.internalFormat, w, h, e.pending.layers, 0, e.pending.format, e.pending.type, source);
+        else if (e.pending.compressed)
+            glCompressedTexImage2D(e.textureTarget, index, e.pending.internalFormat, w, h, 0, (GLsizei)size, source);
+        else
+            glTexImage2D(e.textureTarget, index, e.pending.internalFormat, w, h, 0, e.pending.format, e.pending.type, source);
+        glBindTexture(e.textureTarget, 0);
+        gpuResources().countUpload(size);
+    }
+
+    void swapIn(Entry& e)
+    {
+        glDeleteTextures(1, &e.texture);
+        e.texture = e.pendingTexture;
+        e.pendingTexture = 0;
+        e.ResidentLevel = e.pending.firstLevel;
+        e.baseLevel = 0;
+        e.pending = TextureLevels();
+        e.pendingNext = 0;
+    }
+
+    void workerLoop()
+    {
+        HeapScope heapScope(HEAP_STREAMING);
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            TextureLevels levels = readLevels(job.path, job.firstLevel);
+            levels.id = job.id;
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back(levels);
+        }
+    }
+
+private:
+    // 64-bit: within the validSize() limits this cannot overflow, even where size_t is 32 bits
+    static uint64_t levelSize(const TextureLevels& t, int level, int blockBytes)
+    {
+        uint64_t w = std::max(1, t.width >> level);
+        uint64_t h = std::max(1, t.height >> level);
+        uint64_t layers = std::max(1, t.layers);
+        if (t.compressed)
+            return ((w + 3) / 4) * ((h + 3) / 4) * blockBytes * layers;
+        return w * h * 4 * layers;
+    }
+
+    static uint32_t readU32(const unsigned char* p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static uint64_t readU64(const unsigned char* p)
+    {
+        return (uint64_t)readU32(p) | ((uint64_t)readU32(p + 4) << 32);
+    }
+
+    // a corrupt header must not get as far as levelSize() or the level allocations: a size and
+    // layer count GL can take, and no more levels than a full mip chain down to 1x1 has
+    static bool validSize(const TextureLevels& t)
+    {
+        if (t.width <= 0 || t.height <= 0 || t.width > TEXTURE_MAX_SIZE || t.height > TEXTURE_MAX_SIZE)
+            return false;
+        if (t.layers < 0 || t.layers > TEXTURE_MAX_LAYERS)
+            return false;
+        int fullChain = 1;
+        for (int size = std::max(t.width, t.height); size > 1; size >>= 1)
+            fullChain++;
+        return t.levelCount <= fullChain;
+    }
+
+    // legacy header plus the DX10 extension; dataOffset receives where level 0 starts
+    static bool parseDDS(std::ifstream& file, TextureLevels& t, int& blockBytes, uint64_t& dataOffset)
+    {
+        unsigned char header[124 + 20];
+        file.seekg(4);
+        if (!file.read((char*)header, 124))
+            return false;
+        t.height = (int)readU32(header + 8);
+        t.width = (int)readU32(header + 12);
+        t.levelCount = std::max(1, (int)readU32(header + 24));
+        if (!validSize(t))
+            return false;
+        const unsigned char* pf = header + 72;
+        uint32_t flags = readU32(pf + 4);
+        dataOffset = 4 + 124;
+        if (flags & 0x4)  // DDPF_FOURCC
+        {
+            if (memcmp(pf + 8, "DXT1", 4) == 0) { t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; }
+            else if (memcmp(pf + 8, "DXT3", 4) == 0) { t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; blockBytes = 16; }
+            else if (memcmp(pf + 8, "DXT5", 4) == 0) { t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; }
+            else if (memcmp(pf + 8, "DX10", 4) == 0)
+            {
+                if (!file.read((char*)header + 124, 20))
+                    return false;
+                dataOffset += 20;
+                switch (readU32(header + 124))
+                {
+                case 28: t.internalFormat = GL_RGBA8; t.format = GL_RGBA; t.type = GL_UNSIGNED_BYTE; return true;
+                case 29: t.internalFormat = GL_SRGB8_ALPHA8; t.format = GL_RGBA; t.type = GL_UNSIGNED_BYTE; return true;
+                case 71: t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; break;
+                case 77: t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; break;
+                case 98: t.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; blockBytes = 16; break;
+                case 99: t.internalFormat = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; blockBytes = 16; break;
+                default: return false;
+                }
+            }
+            else
+                return false;
+            t.compressed = true;
+            return true;
+        }
+        // uncompressed: 32 bit RGBA or BGRA only
+        if (readU32(pf + 12) != 32)
+            return false;
+        t.internalFormat = GL_RGBA8;
+        t.format = readU32(pf + 16) == 0x000000ff ? GL_RGBA : GL_BGRA;
+        t.type = GL_UNSIGNED_BYTE;
+        return true;
+    }
+
+    static bool parseKTX2(std::ifstream& file, TextureLevels& t, int& blockBytes, std::vector<uint64_t>& offsets)
+    {
+        unsigned char header[68];
+        if (!file.read((char*)header, 68))
+            return false;
+        uint32_t vkFormat = readU32(header);
+        t.width = (int)readU32(header + 8);
+        t.height = std::max(1, (int)readU32(header + 12));
+        t.layers = (int)readU32(header + 20);
+        t.levelCount = std::max(1, (int)readU32(header + 28));
+        if (!validSize(t))
+            return false;
+        if (readU32(header + 32) != 0)  // supercompressed (BasisLZ/zstd) files need a transcoder
+            return false;
+        switch (vkFormat)
+        {
+        case 37: t.internalFormat = GL_RGBA8; t.format = GL_RGBA; t.type = GL_UNSIGNED_BYTE; break;
+        case 43: t.internalFormat = GL_SRGB8_ALPHA8; t.format = GL_RGBA; t.type = GL_UNSIGNED_BYTE; break;
+        case 44: t.internalFormat = GL_RGBA8; t.format = GL_BGRA; t.type = GL_UNSIGNED_BYTE; break;
+        case 133: t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; t.compressed = true; break;
+        case 135: t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; blockBytes = 16; t.compressed = true; break;
+        case 137: t.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; t.compressed = true; break;
+        case 145: t.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; blockBytes = 16; t.compressed = true; break;
+        case 146: t.internalFormat = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; blockBytes = 16; t.compressed = true; break;
+        default: return false;
+        }
+        for (int i = 0; i < t.levelCount; i++)
+        {
+            unsigned char index[24];
+            if (!file.read((char*)index, 24))
+                return false;
+            offsets.push_back(readU64(index));
+        }
+        return true;
+    }
+};
+
+#endif
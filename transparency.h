@@ -0,0 +1,209 @@
+//
+//  transparency.h
+//  3D Object Drawing
+//
+
+#ifndef TRANSPARENCY_H
+#define TRANSPARENCY_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "gpu_resources.h"
+#include "adaptive_resolution.h"
+
+#include <string>
+#include <iostream>
+
+// Weighted blended order-independent transparency (McGuire and Bavoil). Transparent boxes are
+// drawn after the opaque ones, in any order, into two targets that share the scene's depth
+// buffer: depth is tested but not written, every fragment adds its color times its opacity
+// times a depth weight into GL_RGBA16F accumulation and its opacity times the weight into an
+// R16F sum, and the accumulation's alpha keeps the product of (1 - opacity), how much of the
+// opaque scene still shows through. end() draws the weighted average of the layers over the
+// scene color with that coverage. Nothing is sorted on the CPU, so transparent boxes stay in
+// their batches; in exchange, overlapping layers of very different colors blend approximately.
+// One blend function serves both targets, since GL 3.3 has no per-target blending: color adds
+// up, alpha multiplies by 1 - source alpha, and the sum target has no alpha to multiply.
+// The transparent pass uses fragmentShader.fs compiled with TRANSPARENT defined.
+// GL thread only.
+class TransparencyPass
+{
+public:
+    int Samples;
+    int Width;
+    int Height;
+
+    TransparencyPass(const std::string& vertexPath, const std::string& fragmentPath)
+        : Samples(0), Width(0), Height(0), sceneDepth(0), vertexPath(vertexPath), fragmentPath(fragmentPath), program(NULL) {}
+
+    // binds the accumulation targets with the depth of the scene target, clears them and sets up blending
+    void begin(const SceneTarget& scene)
+    {
+        if (scene.Width != Width || scene.Height != Height || scene.Samples != Samples || scene.Depth != sceneDepth)
+            allocate(scene);
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(framebuffer));
+        gpuResources().countStateChange();
+        static const GLfloat clearAccumulation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        static const GLfloat clearWeights[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+        glClearBufferfv(GL_COLOR, 1, clearWeights);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // blends the accumulated layers over the scene color and leaves the scene target bound
+    void end(const SceneTarget& scene)
+    {
+        glDepthMask(GL_TRUE);
+        if (Samples > 0)
+        {
+            // the resolve reads single-sampled textures; the average of the samples is close enough for sums
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, gpuResources().get(framebuffer));
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gpuResources().get(resolvedFramebuffer));
+            for (int i = 0; i < 2; i++)
+            {
+                glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+                glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+                glBlitFramebuffer(0, 0, Width, Height, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+        }
+        if (program == NULL)
+        {
+            program = new Shader(vertexPath.c_str(), fragmentPath.c_str());
+            accumulationLocation = glGetUniformLocation(program->ID, "accumulation");
+            weightsLocation = glGetUniformLocation(program->ID, "weights");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, scene.FBO);
+        gpuResources().countStateChange();
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        program->use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gpuResources().get(accumulationTexture));
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gpuResources().get(weightsTexture));
+        glUniform1i(accumulationLocation, 0);
+        glUniform1i(weightsLocation, 1);
+        if (gpuResources().get(emptyArray) == 0)
+            emptyArray = gpuResources().create(GPU_VERTEX_ARRAY, "transparency resolve");
+        glBindVertexArray(gpuResources().get(emptyArray));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        gpuResources().countStateChange();
+        gpuResources().countDraw();
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void release()
+    {
+        releaseTargets();
+        if (program != NULL)
+        {
+            glDeleteProgram(program->ID);
+            delete program;
+            program = NULL;
+        }
+        gpuResources().destroy(emptyArray);
+    }
+
+private:
+    GpuHandle framebuffer;
+    GpuHandle accumulationBuffer;       // multisampled attachments, with Samples only
+    GpuHandle weightsBuffer;
+    GpuHandle resolvedFramebuffer;
+    GpuHandle accumulationTexture;      // what the resolve reads: the attachments themselves without samples
+    GpuHandle weightsTexture;
+    GpuHandle emptyArray;
+    unsigned int sceneDepth;            // depth renderbuffer of the scene target the attachments share
+    std::string vertexPath;
+    std::string fragmentPath;
+    Shader* program;
+    GLint accumulationLocation;
+    GLint weightsLocation;
+
+    void releaseTargets()
+    {
+        gpuResources().destroy(framebuffer);
+        gpuResources().destroy(accumulationBuffer);
+        gpuResources().destroy(weightsBuffer);
+        gpuResources().destroy(resolvedFramebuffer);
+        gpuResources().destroy(accumulationTexture);
+        gpuResources().destroy(weightsTexture);
+        Width = Height = 0;
+        sceneDepth = 0;
+    }
+
+    GpuHandle texture(const char* name, GLenum format, GLenum channels, size_t bytes)
+    {
+        GpuHandle handle = gpuResources().create(GPU_TEXTURE, name);
+        gpuResources().setBytes(handle, bytes);
+        glBindTexture(GL_TEXTURE_2D, gpuResources().get(handle));
+        glTexImage2D(GL_TEXTURE_2D, 0, format, Width, Height, 0, channels, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return handle;
+    }
+
+    GpuHandle renderbuffer(const char* name, GLenum format, size_t bytes)
+    {
+        GpuHandle handle = gpuResources().create(GPU_RENDERBUFFER, name);
+        gpuResources().setBytes(handle, bytes * Samples);
+        glBindRenderbuffer(GL_RENDERBUFFER, gpuResources().get(handle));
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, Samples, format, Width, Height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        return handle;
+    }
+
+    // the old targets are only deleted once the GPU is done with the frames drawn into them
+    void allocate(const SceneTarget& scene)
+    {
+        releaseTargets();
+        Width = scene.Width;
+        Height = scene.Height;
+        Samples = scene.Samples;
+        sceneDepth = scene.Depth;
+        size_t pixels = (size_t)Width * Height;
+        static const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+        accumulationTexture = texture("transparency accumulation", GL_RGBA16F, GL_RGBA, pixels * 8);
+        weightsTexture = texture("transparency weights", GL_R16F, GL_RED, pixels * 2);
+        framebuffer = gpuResources().create(GPU_FRAMEBUFFER, "transparency target");
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(framebuffer));
+        if (Samples > 0)
+        {
+            accumulationBuffer = renderbuffer("transparency accumulation samples", GL_RGBA16F, pixels * 8);
+            weightsBuffer = renderbuffer("transparency weight samples", GL_R16F, pixels * 2);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gpuResources().get(accumulationBuffer));
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, gpuResources().get(weightsBuffer));
+        }
+        else
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpuResources().get(accumulationTexture), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gpuResources().get(weightsTexture), 0);
+        }
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scene.Depth);
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::TRANSPARENCY::FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+        if (Samples > 0)
+        {
+            resolvedFramebuffer = gpuResources().create(GPU_FRAMEBUFFER, "transparency resolve target");
+            glBindFramebuffer(GL_FRAMEBUFFER, gpuResources().get(resolvedFramebuffer));
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpuResources().get(accumulationTexture), 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gpuResources().get(weightsTexture), 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::TRANSPARENCY::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,19 @@
+#version 330 core
+
+// weighted blended OIT resolve (see transparency.h), drawn over the opaque scene with
+// GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA blending
+uniform sampler2D accumulation;     // rgb: sum of weighted premultiplied colors, a: revealage
+uniform sampler2D weights;          // r: sum of the weights
+
+out vec4 FragColor;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 accumulated = texelFetch(accumulation, pixel, 0);
+    // revealage 1: nothing transparent in front of the scene here
+    if (accumulated.a >= 1.0)
+        discard;
+    float weight = texelFetch(weights, pixel, 0).r;
+    FragColor = vec4(accumulated.rgb / max(weight, 1e-5), 1.0 - accumulated.a);
+}
@@ -1,16 +1,41 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
+// per instance, see instance_batch.h
+layout (location = 2) in mat4 aModel;
+layout (location = 6) in vec4 aSurface;
+layout (location = 7) in vec4 aAtlasRect;
+layout (location = 8) in float aTextureScale;
+layout (location = 9) in uint aPickId;
+layout (location = 10) in float aOpacity;
 
 out vec4 color;
+out vec3 FragPos;
+out float ViewDepth;
+out vec3 SurfaceColor;
+flat out float TextureLayer;
+flat out vec4 AtlasRect;
+flat out float TextureScale;
+flat out float Selected;
+flat out float Opacity;
 
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform int selectedId;         // placement picked with the mouse, 0 for none
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    vec4 worldPos = aModel * vec4(aPos, 1.0f);
+    vec4 viewPos = view * worldPos;
+    gl_Position = projection * viewPos;
     color = vec4(aColor, 1.0f);
+    FragPos = worldPos.xyz;
+    ViewDepth = -viewPos.z;
+    SurfaceColor = aSurface.rgb;
+    TextureLayer = aSurface.a;
+    AtlasRect = aAtlasRect;
+    TextureScale = aTextureScale;
+    Selected = (selectedId != 0 && int(aPickId) == selectedId) ? 1.0 : 0.0;
+    Opacity = aOpacity;
 }
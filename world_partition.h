@@ -0,0 +1,344 @@
+//
+//  world_partition.h
+//  3D Object Drawing
+//
+
+#ifndef WORLD_PARTITION_H
+#define WORLD_PARTITION_H
+
+#include <glm/glm.hpp>
+
+#include "instance_batch.h"
+#include "scene.h"
+#include "frustum.h"
+#include "frame_arena.h"
+
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Default partition values
+const float CELL_SIZE = 8.0f;                               // grid spacing on the floor plane
+const float CELL_LOAD_RADIUS = 12.0f;                       // cells whose bounds come this close to the camera are loaded
+const size_t CELL_BUDGET = 4u * 1024u * 1024u;              // GPU bytes of resident cell buffers
+const size_t CELL_UPLOAD_PER_FRAME = 256u * 1024u;          // cell bytes uploaded per frame (at least one cell)
+
+
+// Static placements split into a grid of cells on the XZ plane. A placement belongs to the
+// cell under the center of its bounds; a cell's bounds grow to cover everything in it, so
+// the long wall slabs keep their cell alive from anywhere along them.
+//  - cells whose bounds are within CELL_LOAD_RADIUS of the camera are built on a worker
+//    thread (prefabs expanded into instances, bounds and draw commands)
+//  - built cells are uploaded nearest first, CELL_UPLOAD_PER_FRAME bytes per frame
+//  - when the resident cells exceed the budget, cells out of range are evicted farthest first
+class WorldPartition
+{
+public:
+    // expands one placement into instances; runs on the worker thread
+    typedef std::function<void(InstanceBatch&, const ScenePrefab&, const glm::mat4&)> Builder;
+
+    WorldPartition(const MeshBuffer& meshBuffer, Builder placementBuilder, size_t budget = CELL_BUDGET, size_t uploadPerFrame = CELL_UPLOAD_PER_FRAME)
+        : Budget(budget), UploadPerFrame(uploadPerFrame), meshes(meshBuffer), builder(placementBuilder), stopping(false)
+    {
+        worker = std::thread(&WorldPartition::workerLoop, this);
+    }
+
+    ~WorldPartition()
+    {
+        stop();
+    }
+
+    size_t Budget;
+    size_t UploadPerFrame;
+
+    // adds a static placement; a cell that is already resident is rebuilt in the background
+    void add(const ScenePlacement& placement, const ScenePrefab& prefab)
+    {
+        std::shared_ptr<const ScenePrefab>& shared = prefabs[prefab.name];
+        if (!shared)
+            shared = std::make_shared<const ScenePrefab>(prefab);
+
+        glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+        for (size_t i = 0; i < prefab.boxes.size(); i++)
+        {
+            int mesh = meshes.find(prefab.boxes[i].mesh);
+            if (mesh < 0)
+                continue;
+            InstanceBounds box = meshes.bounds(mesh, placement.transform * prefab.boxes[i].transform);
+            boundsMin = glm::min(boundsMin, box.center - box.halfSize);
+            boundsMax = glm::max(boundsMax, box.center + box.halfSize);
+        }
+        if (boundsMin.x > boundsMax.x)
+            return;
+
+        glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+        std::pair<int, int> key((int)std::floor(center.x / CELL_SIZE), (int)std::floor(center.z / CELL_SIZE));
+        std::map<std::pair<int, int>, size_t>::iterator it = cellIndex.find(key);
+        if (it == cellIndex.end())
+        {
+            it = cellIndex.insert(std::make_pair(key, cells.size())).first;
+            cells.push_back(Cell());
+            cells.back().boundsMin = boundsMin;
+            cells.back().boundsMax = boundsMax;
+        }
+        Cell& cell = cells[it->second];
+        Item item = { shared, placement.transform, placement.id };
+        cell.items.push_back(item);
+        cell.boundsMin = glm::min(cell.boundsMin, boundsMin);
+        cell.boundsMax = glm::max(cell.boundsMax, boundsMax);
+        cell.version++;
+    }
+
+    // once per frame on the GL thread; returns true when the resident geometry changed
+    bool update(glm::vec3 cameraPosition)
+    {
+        bool changed = false;
+        collectResults();
+
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            Cell& cell = cells[i];
+            glm::vec3 nearest = glm::clamp(cameraPosition, cell.boundsMin, cell.boundsMax);
+            cell.distance = glm::distance(cameraPosition, nearest);
+            cell.wanted = cell.distance <= CELL_LOAD_RADIUS;
+            if (!cell.wanted && cell.pending)
+            {
+                cell.pending.reset();
+                cell.pendingVersion = -1;
+            }
+            if (cell.wanted && cell.buildingVersion < 0 && cell.pendingVersion != cell.version && cell.residentVersion != cell.version)
+                schedule(i);
+        }
+
+        // uploads, nearest first
+        FrameVector<size_t> order(frameArena());
+        order.reserve(cells.size());
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].pending)
+                order.push_back(i);
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return cells[a].distance < cells[b].distance; });
+        size_t uploaded = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            Cell& cell = cells[order[i]];
+            size_t size = cell.pending->bytes();
+            if (uploaded > 0 && uploaded + size > UploadPerFrame)
+                break;
+            cell.pending->upload();
+            if (cell.batch)
+                cell.batch->release();
+            cell.batch = std::move(cell.pending);
+            cell.residentVersion = cell.pendingVersion;
+            cell.pendingVersion = -1;
+            uploaded += size;
+            changed = true;
+        }
+
+        // budget: drop cells out of range, farthest first
+        order.clear();
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch && !cells[i].wanted)
+                order.push_back(i);
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return cells[a].distance > cells[b].distance; });
+        size_t total = residentBytes();
+        for (size_t i = 0; i < order.size() && total > Budget; i++)
+        {
+            Cell& cell = cells[order[i]];
+            total -= cell.batch->bytes();
+            cell.batch->release();
+            cell.batch.reset();
+            cell.residentVersion = -1;
+            changed = true;
+        }
+        return changed;
+    }
+
+    template <class Volume>
+    void cull(const Volume& volume)
+    {
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                cells[i].batch->cull(volume);
+    }
+
+    void draw(DrawPass pass = DRAW_ALL)
+    {
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                cells[i].batch->draw(pass);
+    }
+
+    // transparent boxes left by the last cull
+    int visibleTransparent() const
+    {
+        int count = 0;
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                count += cells[i].batch->VisibleTransparent;
+        return count;
+    }
+
+    // appends the batches of the resident cells; any vector of const InstanceBatch* will do
+    template <class Container>
+    void residentBatches(Container& batches) const
+    {
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                batches.push_back(cells[i].batch.get());
+    }
+
+    size_t residentBytes() const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                total += cells[i].batch->bytes();
+        return total;
+    }
+
+    int residentCells() const
+    {
+        int count = 0;
+        for (size_t i = 0; i < cells.size(); i++)
+            count += cells[i].batch ? 1 : 0;
+        return count;
+    }
+
+    int cellCount() const
+    {
+        return (int)cells.size();
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    void release()
+    {
+        stop();
+        for (size_t i = 0; i < cells.size(); i++)
+            if (cells[i].batch)
+                cells[i].batch->release();
+    }
+
+private:
+    struct Item
+    {
+        std::shared_ptr<const ScenePrefab> prefab;
+        glm::mat4 transform;
+        unsigned int pickId;
+    };
+    struct Cell
+    {
+        std::vector<Item> items;
+        glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+        std::unique_ptr<InstanceBatch> batch;       // resident, drawn
+        std::unique_ptr<InstanceBatch> pending;     // built, waiting for its upload
+        int version = 0;                            // bumped whenever items change
+        int residentVersion = -1, pendingVersion = -1, buildingVersion = -1;
+        float distance = 0.0f;
+        bool wanted = false;
+    };
+    struct Job
+    {
+        size_t cell;
+        int version;
+        std::vector<Item> items;
+    };
+    struct Result
+    {
+        size_t cell;
+        int version;
+        std::unique_ptr<InstanceBatch> batch;
+    };
+
+    const MeshBuffer& meshes;
+    Builder builder;
+    std::map<std::string, std::shared_ptr<const ScenePrefab> > prefabs;
+    std::map<std::pair<int, int>, size_t> cellIndex;
+    std::vector<Cell> cells;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::vector<Result> results;
+    bool stopping;
+
+    void schedule(size_t index)
+    {
+        Cell& cell = cells[index];
+        Job job;
+        job.cell = index;
+        job.version = cell.version;
+        job.items = cell.items;
+        cell.buildingVersion = cell.version;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        wake.notify_one();
+    }
+
+    void collectResults()
+    {
+        std::vector<Result> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.swap(results);
+        }
+        for (size_t i = 0; i < done.size(); i++)
+        {
+            Cell& cell = cells[done[i].cell];
+            cell.buildingVersion = -1;
+            // items were added while it was being built: throw it away, update() schedules again
+            if (done[i].version != cell.version)
+                continue;
+            cell.pending = std::move(done[i].batch);
+            cell.pendingVersion = done[i].version;
+        }
+    }
+
+    void workerLoop()
+    {
+        HeapScope heapScope(HEAP_SCENE);
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            Result result;
+            result.cell = job.cell;
+            result.version = job.version;
+            result.batch.reset(new InstanceBatch(meshes));
+            for (size_t i = 0; i < job.items.size(); i++)
+            {
+                result.batch->setPickId(job.items[i].pickId);
+                builder(*result.batch, *job.items[i].prefab, job.items[i].transform);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back(std::move(result));
+        }
+    }
+};
+
+#endif